@@ -0,0 +1,88 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "interval.h"
+#include "mlem.h"
+#include "ray.h"
+#include "vec3.h"
+
+// Axis-aligned bounding box, one interval per axis.
+class aabb {
+    public:
+        interval x, y, z;
+
+    public:
+        aabb() {} // empty box, intervals default to empty.
+
+        aabb(const interval& ix, const interval& iy, const interval& iz) : x(ix), y(iy), z(iz) {
+            pad_to_minimums();
+        }
+
+        aabb(const point3& a, const point3& b) {
+            // treat the two points as extrema, in any order.
+            x = interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
+            y = interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
+            z = interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+            pad_to_minimums();
+        }
+
+        aabb(const aabb& box0, const aabb& box1)
+            : x(box0.x, box1.x), y(box0.y, box1.y), z(box0.z, box1.z) {}
+
+        const interval& axis(int n) const {
+            if (n == 1) return y;
+            if (n == 2) return z;
+            return x;
+        }
+
+        int longest_axis() const {
+            if (x.size() > y.size()) {
+                return x.size() > z.size() ? 0 : 2;
+            }
+            return y.size() > z.size() ? 1 : 2;
+        }
+
+        point3 centroid() const {
+            return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+        }
+
+        aabb translated(const vec3& offset) const {
+            return aabb(interval(x.min + offset.x(), x.max + offset.x()),
+                        interval(y.min + offset.y(), y.max + offset.y()),
+                        interval(z.min + offset.z(), z.max + offset.z()));
+        }
+
+        bool hit(const ray& r, interval ray_t) const {
+            // slab test, narrowing ray_t axis by axis.
+            const point3& ray_orig = r.orig;
+            const vec3&   ray_dir  = r.dir;
+
+            for (int a = 0; a < 3; a++) {
+                const interval& ax = axis(a);
+                const double adinv = 1.0 / ray_dir[a];
+
+                auto t0 = (ax.min - ray_orig[a]) * adinv;
+                auto t1 = (ax.max - ray_orig[a]) * adinv;
+
+                if (t0 > t1) std::swap(t0, t1);
+                if (t0 > ray_t.min) ray_t.min = t0;
+                if (t1 < ray_t.max) ray_t.max = t1;
+
+                if (ray_t.max <= ray_t.min) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        void pad_to_minimums() {
+            // avoid zero-thickness boxes so the slab test stays well defined.
+            double delta = 0.0001;
+            if (x.size() < delta) x = x.expand(delta);
+            if (y.size() < delta) y = y.expand(delta);
+            if (z.size() < delta) z = z.expand(delta);
+        }
+};
+
+#endif
@@ -0,0 +1,105 @@
+// Alias table check: sampling has to reproduce weights[i] / sum(weights), never pick a
+// zero weight, and remap the leftover of u into [0,1). The environment light built on it
+// has to report the same pdf for a direction it sampled as pdf_direction() does, and that
+// pdf has to integrate to one over the sphere.
+//
+// Usage: ./alias_check        prints the worst error per case, exits 1 on any failure
+//
+// The tables are swept with evenly spaced u, so the sampled frequencies match the pmf up
+// to the sweep resolution rather than up to Monte Carlo noise.
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "alias_table.h"
+#include "environment.h"
+
+struct weight_case {
+    const char* name;
+    std::vector<double> weights;
+};
+
+bool check_table(const weight_case& c) {
+    alias_table table(c.weights);
+    const size_t n = c.weights.size();
+    const size_t sweep = 20000 * n;
+    std::vector<double> freq(n, 0);
+    bool remap_ok = true;
+    for (size_t m = 0; m < sweep; ++m) {
+        double remapped;
+        size_t i = table.sample((m + 0.5) / sweep, &remapped);
+        freq[i] += 1.0 / sweep;
+        remap_ok = remap_ok && remapped >= 0 && remapped < 1;
+    }
+
+    double sum = 0;
+    for (double w : c.weights) sum += std::max(0.0, w);
+    double worst = 0, pmf_error = 0;
+    bool zero_picked = false;
+    for (size_t i = 0; i < n; ++i) {
+        double expected = sum > 0 ? std::max(0.0, c.weights[i]) / sum : 1.0 / n;
+        worst = std::max(worst, std::fabs(freq[i] - expected));
+        pmf_error = std::max(pmf_error, std::fabs(table.probability(i) - expected));
+        zero_picked = zero_picked || (expected == 0 && freq[i] > 0);
+    }
+    bool ok = worst < 1e-3 && pmf_error < 1e-12 && !zero_picked && remap_ok;
+    std::printf("%-10s n=%-4zu  max |freq - pmf| %.2e%s%s%s\n", c.name, n, worst,
+                zero_picked ? "  zero weight picked" : "", remap_ok ? "" : "  remap out of range",
+                ok ? "" : "  FAIL");
+    return ok;
+}
+
+bool check_environment() {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> u(0, 1);
+    const int w = 32, h = 16;
+    std::vector<color> pixels(w * h);
+    for (auto& p : pixels) {
+        double s = u(rng) < 0.1 ? 50 : u(rng);
+        p = color(s, 0.5 * s, 0.25 * s);
+    }
+    pixels[3] = color(0, 0, 0);
+    environment_light env(w, h, pixels);
+
+    // sampled pdf against the lookup for the same direction.
+    int mismatches = 0;
+    for (int k = 0; k < 20000; ++k) {
+        light_sample ls;
+        if (!env.sample(point3(0, 0, 0), ls)) continue;
+        double looked_up = env.pdf_direction(ls.wi);
+        if (std::fabs(looked_up - ls.pdf) > 1e-6 * ls.pdf) ++mismatches;
+    }
+
+    // uniform directions: E[pdf / (1 / 4pi)] = integral of pdf over the sphere.
+    const int samples = 200000;
+    double integral = 0;
+    for (int k = 0; k < samples; ++k) {
+        double z = 1 - 2 * u(rng), phi = 2 * M_PI * u(rng), r = std::sqrt(std::max(0.0, 1 - z * z));
+        integral += env.pdf_direction(vec3(r * std::cos(phi), z, r * std::sin(phi))) * 4 * M_PI / samples;
+    }
+    bool ok = mismatches == 0 && std::fabs(integral - 1) < 0.02;
+    std::printf("environment  %d pdf mismatches  pdf integrates to %.4f%s\n", mismatches, integral, ok ? "" : "  FAIL");
+    return ok;
+}
+
+int main() {
+    std::vector<double> many(257);
+    for (size_t i = 0; i < many.size(); ++i) many[i] = (i % 7 == 0) ? 0 : std::pow(1.05, double(i));
+
+    std::vector<weight_case> cases = {
+        {"single", {2.5}},
+        {"uniform", {1, 1, 1, 1}},
+        {"skewed", {1000, 1, 0.001, 1, 3}},
+        {"zeros", {0, 4, 0, 0, 1, 0}},
+        {"all-zero", {0, 0, 0}},
+        {"negative", {-1, 2, 3}},
+        {"many", many},
+    };
+
+    int failures = 0;
+    for (const auto& c : cases) {
+        failures += !check_table(c);
+    }
+    failures += !check_environment();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Walker/Vose alias table: samples index i with probability weights[i] / sum(weights)
+// in constant time from a single uniform number.
+class alias_table {
+    public:
+        alias_table() {}
+
+        explicit alias_table(const std::vector<double>& weights) {
+            const size_t n = weights.size();
+            prob.assign(n, 1.0f);
+            alias.assign(n, 0);
+            pmf.assign(n, 0.0);
+            if (n == 0) return;
+
+            double sum = 0;
+            for (double w : weights) sum += std::max(0.0, w);
+            if (sum <= 0) {
+                // nothing to prefer, fall back to uniform.
+                for (size_t i = 0; i < n; ++i) {
+                    pmf[i] = 1.0 / n;
+                    alias[i] = static_cast<uint32_t>(i);
+                }
+                return;
+            }
+
+            std::vector<double> scaled(n);
+            std::vector<uint32_t> small, large;
+            for (size_t i = 0; i < n; ++i) {
+                pmf[i] = std::max(0.0, weights[i]) / sum;
+                scaled[i] = pmf[i] * n;
+                (scaled[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+            }
+
+            while (!small.empty() && !large.empty()) {
+                uint32_t s = small.back(); small.pop_back();
+                uint32_t l = large.back(); large.pop_back();
+                prob[s] = static_cast<float>(scaled[s]);
+                alias[s] = l;
+                scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+                (scaled[l] < 1.0 ? small : large).push_back(l);
+            }
+            // leftovers are 1 up to rounding.
+            for (uint32_t i : large) { prob[i] = 1.0f; alias[i] = i; }
+            for (uint32_t i : small) { prob[i] = 1.0f; alias[i] = i; }
+        }
+
+        size_t size() const { return prob.size(); }
+
+        // u in [0,1). Returns the index, and the leftover of u rescaled to [0,1) in 'remapped'.
+        size_t sample(double u, double* remapped = nullptr) const {
+            double x = u * prob.size();
+            size_t i = std::min(static_cast<size_t>(x), prob.size() - 1);
+            double frac = x - i;
+            if (frac < prob[i]) {
+                if (remapped) *remapped = frac / prob[i];
+                return i;
+            }
+            if (remapped) *remapped = (frac - prob[i]) / (1.0 - prob[i]);
+            return alias[i];
+        }
+
+        double probability(size_t i) const { return pmf[i]; }
+
+    private:
+        std::vector<float>    prob;
+        std::vector<uint32_t> alias;
+        std::vector<double>   pmf;
+};
+
+#endif
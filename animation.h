@@ -0,0 +1,104 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "hittable.h"
+#include "camera.h"
+#include "light.h"
+#include "vec3.h"
+
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <string>
+#include <vector>
+
+// Camera keyframe, only the fields that change over a shot.
+struct camera_key {
+    point3 lookfrom;
+    point3 lookat;
+};
+
+class camera_path {
+    public:
+        std::vector<camera_key> keys;
+        bool closed = false;   // the last key repeats the first, as in a loop
+
+    public:
+        camera_path() {}
+
+        void add(const point3& lookfrom, const point3& lookat) {
+            keys.push_back({lookfrom, lookat});
+        }
+
+        // Circle of 'steps' keys around 'lookat' in the horizontal plane, starting at 'lookfrom'.
+        static camera_path orbit(const point3& lookfrom, const point3& lookat, int steps = 64) {
+            camera_path path;
+            path.closed = true;
+            vec3 offset = lookfrom - lookat;
+            for (int k = 0; k <= steps; ++k) {
+                auto angle = 2 * M_PI * k / steps;
+                auto c = std::cos(angle), s = std::sin(angle);
+                vec3 rotated(c * offset.x() + s * offset.z(), offset.y(), -s * offset.x() + c * offset.z());
+                path.add(lookat + rotated, lookat);
+            }
+            return path;
+        }
+
+        // Piecewise linear interpolation, s in [0,1] over the whole path.
+        camera_key at(double s) const {
+            if (keys.size() == 1) {
+                return keys[0];
+            }
+            auto x = interval(0, 1).clamp(s) * (keys.size() - 1);
+            auto k = std::min(static_cast<size_t>(x), keys.size() - 2);
+            auto f = x - k;
+            return { (1 - f) * keys[k].lookfrom + f * keys[k+1].lookfrom,
+                     (1 - f) * keys[k].lookat   + f * keys[k+1].lookat };
+        }
+};
+
+// Renders 'frames' images along 'path' into files named like 'pattern' (printf style,
+// e.g. "frame_%04d.ppm"). The scene and the camera's render threads are reused for every
+// frame, and frame k is written to disk while frame k+1 is being rendered.
+void render_animation(camera& cam, const hittable& world, const light_list& lights,
+                      const camera_path& path, int frames, const std::string& pattern) {
+    if (path.keys.empty() || frames <= 0) {
+        return;
+    }
+
+    color_buffer buffers[2];
+    std::future<void> writer;
+
+    for (int k = 0; k < frames; ++k) {
+        // a closed path loops back to frame 0, so the last frame stops one step short of it.
+        auto span = path.closed ? frames : frames - 1;
+        auto key = path.at(span > 0 ? double(k) / span : 0.0);
+        cam.lookfrom = key.lookfrom;
+        cam.lookat   = key.lookat;
+
+        // frame k-1 is still being written from the other buffer while this one renders.
+        auto& framebuffer = buffers[k % 2];
+        cam.render_frame(world, lights, framebuffer);
+
+        if (writer.valid()) {
+            writer.get();
+        }
+
+        char filename[1024];
+        std::snprintf(filename, sizeof(filename), pattern.c_str(), k);
+        std::string name(filename);
+        camera frame_cam = cam;  // image size is all write_image needs, the copy shares the threads.
+        writer = std::async(std::launch::async, [frame_cam, name, &framebuffer]() {
+            std::ofstream out(name);
+            frame_cam.write_image(out, framebuffer);
+        });
+
+        std::clog << "\rFrame " << (k + 1) << "/" << frames << " rendered.\n";
+    }
+
+    if (writer.valid()) {
+        writer.get();
+    }
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "hittable.h"
+#include "camera.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct autotune_settings {
+    std::vector<int> thread_counts;        // empty: 0.5, 1, 1.5 and 2 per hardware thread
+    std::vector<int> block_sizes = {16, 32, 64, 128};
+    int    calibration_crop  = 0;          // edge of the full-resolution crop that is timed, 0 = big
+    int    blocks_per_thread = 4;          // enough for this many of the largest blocks per thread
+    int    calibration_spp   = 4;          // at most, lowered on big crops to stay near
+    double calibration_samples = 262144;   // this many samples per timed render
+    int    calibration_runs  = 3;          // timed renders per candidate, the median counts
+    std::string cache_path;                // where results are kept per fingerprint, empty = no cache
+};
+
+struct autotune_result {
+    int    threads = 0;
+    int    block_size = 0;
+    double samples_per_second = 0;
+    bool   from_cache = false;
+};
+
+// Identifies the machine and the scene setup a tuning result is valid for.
+inline std::string autotune_fingerprint(const camera& cam, const hittable& world, const light_list& lights) {
+    std::string cpu;
+    std::ifstream info("/proc/cpuinfo");
+    for (std::string line; std::getline(info, line);) {
+        if (line.compare(0, 10, "model name") == 0) {
+            cpu = line.substr(line.find(':') + 1);
+            break;
+        }
+    }
+
+    std::vector<const hittable*> prims;
+    world.collect_primitives(prims);
+    aabb box = world.bounding_box();
+
+    std::ostringstream scene;
+    scene << cpu << '|' << std::thread::hardware_concurrency() << '|' << prims.size() << '|' << lights.lights.size()
+          << '|' << box.x.min << ',' << box.x.max << ',' << box.y.min << ',' << box.y.max << ','
+          << box.z.min << ',' << box.z.max << '|' << cam.image_width << '|' << cam.max_depth << '|'
+          << cam.defocus_angle << '|' << (cam.shutter_close > cam.shutter_open) << '|' << cam.raster_primary;
+
+    // FNV-1a
+    uint64_t h = 1469598103934665603ull;
+    for (char c : scene.str()) {
+        h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    std::ostringstream hex;
+    hex << std::hex << h;
+    return hex.str();
+}
+
+// Times short renders of a crop from the middle of the actual frame, at full resolution so
+// blocks cover the same pixels as in the real render, for every combination of thread
+// count and block size, and sets the fastest on 'cam' (num_threads, block_size). The crop
+// holds several of the largest blocks per thread of the largest count, so no candidate is
+// timed with threads left idle, and the median of a few renders keeps one unlucky run
+// from deciding.
+// With settings.cache_path, a result stored for the same fingerprint is used instead and
+// new results are appended.
+inline autotune_result autotune(camera& cam, const hittable& world, const light_list& lights,
+                                const autotune_settings& settings = autotune_settings()) {
+    autotune_result best;
+    const std::string fingerprint = autotune_fingerprint(cam, world, lights);
+
+    if (!settings.cache_path.empty()) {
+        std::ifstream in(settings.cache_path);
+        std::string key;
+        autotune_result cached;
+        while (in >> key >> cached.threads >> cached.block_size >> cached.samples_per_second) {
+            if (key == fingerprint) {
+                best = cached;
+                best.from_cache = true;
+            }
+        }
+        if (best.from_cache) {
+            cam.num_threads = best.threads;
+            cam.block_size = best.block_size;
+            return best;
+        }
+    }
+
+    std::vector<int> threads = settings.thread_counts;
+    if (threads.empty()) {
+        const int hw = std::max(1u, std::thread::hardware_concurrency());
+        for (double f : {0.5, 1.0, 1.5, 2.0}) {
+            threads.push_back(std::max(1, static_cast<int>(hw * f)));
+        }
+    }
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+
+    // a copy, so the calibration frames leave the caller's camera and buffers alone. It gets
+    // no radiance cache, which would warm up from one candidate to the next, and no caustic
+    // photons, which would be shot again for every timed frame.
+    camera probe = cam;
+    probe.separate_workers();
+    probe.cache = nullptr;
+    probe.caustic_photons = 0;
+    probe.show_progress = false;
+
+    int crop = settings.calibration_crop;
+    if (crop <= 0) {
+        int largest_block = settings.block_sizes.empty() ? cam.block_size : 1;
+        for (int b : settings.block_sizes) largest_block = std::max(largest_block, b);
+        const double blocks = std::max(1, settings.blocks_per_thread) * double(threads.back());
+        crop = largest_block * static_cast<int>(std::ceil(std::sqrt(blocks)));
+    }
+    const int crop_w = std::max(1, std::min(cam.image_width, crop));
+    const int crop_h = std::max(1, std::min(cam.output_height(), crop));
+    const int crop_x = (cam.image_width - crop_w) / 2;
+    const int crop_y = (cam.output_height() - crop_h) / 2;
+    const int spp = std::max(1, std::min(settings.calibration_spp,
+                                         static_cast<int>(settings.calibration_samples / (double(crop_w) * crop_h))));
+    const double samples = double(crop_w) * crop_h * spp;
+    const int runs = std::max(1, settings.calibration_runs);
+
+    std::vector<color> tile;
+    std::vector<double> times(runs);
+    for (int t : threads) {
+        probe.num_threads = t;
+        // the first crop on a new thread count also starts the threads, it isn't timed.
+        probe.render_region(world, lights, crop_x, crop_y, crop_w, crop_h, spp, tile);
+        for (int b : settings.block_sizes) {
+            probe.block_size = b;
+            for (int run = 0; run < runs; ++run) {
+                auto start = std::chrono::steady_clock::now();
+                probe.render_region(world, lights, crop_x, crop_y, crop_w, crop_h, spp, tile);
+                times[run] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            std::nth_element(times.begin(), times.begin() + runs / 2, times.end());
+            double rate = samples / std::max(times[runs / 2], 1e-9);
+            if (rate > best.samples_per_second) {
+                best.threads = t;
+                best.block_size = b;
+                best.samples_per_second = rate;
+            }
+        }
+    }
+
+    cam.num_threads = best.threads;
+    cam.block_size = best.block_size;
+
+    if (!settings.cache_path.empty()) {
+        std::ofstream out(settings.cache_path, std::ios::app);
+        out << fingerprint << ' ' << best.threads << ' ' << best.block_size << ' ' << best.samples_per_second << '\n';
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,67 @@
+// Time budget check: camera::time_budget has to bound the wall time of a frame, including
+// when the budget is too small for a full pass at one sample per pixel, and every pixel of
+// the frame has to come out finite and filled (0.1s here is well under one full pass).
+//
+// Usage: ./budget_check       prints the wall time per budget, exits 1 on overrun or holes
+//
+// The allowed overrun is a fifth of the budget plus a fixed slack for the denoiser-free
+// resolve of the frame and the last row or tile each thread was already working on.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include "hittable_list.h"
+#include "camera.h"
+#include "bvh8.h"
+#include "material.h"
+#include "sphere.h"
+#include "vec3.h"
+
+using std::make_shared;
+
+int main() {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> u(-4, 4);
+
+    hittable_list world;
+    auto ground = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    auto glass = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
+    for (int k = 0; k < 200; ++k) {
+        auto mat = k % 3 == 0 ? shared_ptr<material>(glass)
+                              : shared_ptr<material>(make_shared<lambertian>(color(0.2, 0.6, 0.8)));
+        world.add(make_shared<sphere>(point3(u(rng), 0.3, u(rng)), 0.3, mat));
+    }
+    world = hittable_list(make_shared<bvh8>(world));
+
+    int failures = 0;
+    for (double budget : {0.1, 0.5}) {
+        camera cam;
+        cam.aspect_ratio = 16.0 / 9.0;
+        cam.image_width = 640;
+        cam.max_depth = 50;
+        cam.vfov = 40;
+        cam.lookfrom = point3(0, 2, 9);
+        cam.lookat = point3(0, 0, 0);
+        cam.show_progress = false;
+        cam.time_budget = budget;
+
+        color_buffer framebuffer;
+        auto start = std::chrono::steady_clock::now();
+        cam.render_frame(world, light_list(), framebuffer);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // a single path can legitimately come back black, the first-hit albedo can't.
+        int holes = 0;
+        for (size_t k = 0; k < framebuffer.size(); ++k) {
+            const color& c = framebuffer[k];
+            bool finite = std::isfinite(c.x()) && std::isfinite(c.y()) && std::isfinite(c.z());
+            if (!finite || cam.aovs.albedo[k].length_squared() == 0) ++holes;
+        }
+        bool over = seconds > 1.2 * budget + 0.05;
+        std::printf("budget %.2fs  took %.3fs%s  %d bad pixels\n", budget, seconds, over ? " (over)" : "", holes);
+        failures += over + (holes > 0);
+    }
+    return failures == 0 ? 0 : 1;
+}
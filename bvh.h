@@ -0,0 +1,124 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <vector>
+
+// Bounding volume hierarchy over hittables. Moving objects are bounded over the whole
+// shutter range by their own bounding_box(), and are kept in their own subtree so their
+// larger boxes don't loosen the nodes of the static part of the scene.
+class bvh_node : public hittable {
+    public:
+        bvh_node(const hittable_list& list) {
+            std::vector<shared_ptr<hittable>> static_objects, moving_objects;
+            for (const auto& object : list.objects) {
+                (object->is_moving() ? moving_objects : static_objects).push_back(object);
+            }
+
+            if (static_objects.empty() || moving_objects.empty()) {
+                auto objects = list.objects;
+                build(objects, 0, objects.size());
+            } else {
+                left  = make_shared<bvh_node>(static_objects, 0, static_objects.size());
+                right = make_shared<bvh_node>(moving_objects, 0, moving_objects.size());
+                bbox  = aabb(left->bounding_box(), right->bounding_box());
+            }
+        }
+
+        bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+            build(objects, start, end);
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            double t;
+            const hittable* prim;
+            if (!intersect(r, ray_t, t, prim)) {
+                return false;
+            }
+            prim->fill_hit_record(r, t, rec);
+            return true;
+        }
+
+        bool intersect(const ray& r, interval ray_t, double& t, const hittable*& prim) const override {
+            if (!bbox.hit(r, ray_t)) {
+                return false;
+            }
+
+            bool hit_left = left->intersect(r, ray_t, t, prim);
+            bool hit_right = (right != left) && right->intersect(r, interval(ray_t.min, hit_left ? t : ray_t.max), t, prim);
+
+            return hit_left || hit_right;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            if (!bbox.hit(r, ray_t)) {
+                return false;
+            }
+            return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        bool is_moving() const override { return left->is_moving() || right->is_moving(); }
+
+        void collect_primitives(std::vector<const hittable*>& out) const override {
+            left->collect_primitives(out);
+            if (right != left) {
+                right->collect_primitives(out);
+            }
+        }
+
+        // Children, for collapsing into a wider tree. A single-object leaf has left == right.
+        const shared_ptr<hittable>& left_child() const { return left; }
+        const shared_ptr<hittable>& right_child() const { return right; }
+
+    private:
+        shared_ptr<hittable> left;
+        shared_ptr<hittable> right;
+        aabb bbox;
+
+        void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i) {
+                bbox = aabb(bbox, objects[i]->bounding_box());
+            }
+
+            size_t object_span = end - start;
+            if (object_span == 0) {
+                // empty scene: an empty list never hits, and the box stays empty.
+                left = right = make_shared<hittable_list>();
+                return;
+            }
+            if (object_span == 1) {
+                left = right = objects[start];
+                return;
+            }
+            if (object_span == 2) {
+                left = objects[start];
+                right = objects[start + 1];
+                return;
+            }
+
+            // median split along the axis where the centroids spread the most.
+            aabb centroid_bounds;
+            for (size_t i = start; i < end; ++i) {
+                auto c = objects[i]->bounding_box().centroid();
+                centroid_bounds = aabb(centroid_bounds, aabb(c, c));
+            }
+            int axis = centroid_bounds.longest_axis();
+
+            auto mid = start + object_span / 2;
+            std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end,
+                [axis](const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
+                    return a->bounding_box().centroid()[axis] < b->bounding_box().centroid()[axis];
+                });
+
+            left  = make_shared<bvh_node>(objects, start, mid);
+            right = make_shared<bvh_node>(objects, mid, end);
+        }
+};
+
+#endif
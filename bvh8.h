@@ -0,0 +1,295 @@
+#ifndef BVH8_H
+#define BVH8_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 8-wide node. Child boxes are stored as 8-bit offsets from the node origin in steps of
+// 2^exponent per axis, so a node is 96 bytes and a whole level of the binary tree is
+// tested against the ray in one pass.
+struct bvh8_node {
+    float   origin[3];
+    int8_t  exponent[3];
+    uint8_t child_count;
+    uint8_t lo[3][8];       // quantized child box minimum, per axis
+    uint8_t hi[3][8];       // quantized child box maximum, per axis
+    int32_t child[8];       // >= 0: node index, < 0: ~index into the primitive array
+};
+
+// Wide BVH collapsed from a binary bvh_node. Internal nodes of the binary tree are pulled
+// up into their ancestor until it has 8 children, always opening the largest box first.
+class bvh8 : public hittable {
+    public:
+        bvh8(const hittable_list& list) : bvh8(bvh_node(list)) {}
+
+        bvh8(const bvh_node& root) : bbox(root.bounding_box()) {
+            nodes.reserve(64);
+            nodes.emplace_back();
+            collapse(root, 0);
+            node_data = aligned_nodes(nodes);
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            double t;
+            const hittable* prim;
+            if (!traverse(r, ray_t, false, t, prim)) {
+                return false;
+            }
+            prim->fill_hit_record(r, t, rec);
+            return true;
+        }
+
+        bool intersect(const ray& r, interval ray_t, double& t, const hittable*& prim) const override {
+            return traverse(r, ray_t, false, t, prim);
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            double t;
+            const hittable* prim;
+            return traverse(r, ray_t, true, t, prim);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        bool is_moving() const override {
+            for (const auto& p : primitives) {
+                if (p->is_moving()) return true;
+            }
+            return false;
+        }
+
+        void collect_primitives(std::vector<const hittable*>& out) const override {
+            for (const auto& p : primitives) {
+                p->collect_primitives(out);
+            }
+        }
+
+    private:
+        struct free_deleter {
+            void operator()(bvh8_node* p) const { std::free(p); }
+        };
+
+        std::vector<bvh8_node> nodes;                            // built here, then copied
+        std::unique_ptr<bvh8_node, free_deleter> node_data;      // cache line aligned copy
+        std::vector<shared_ptr<hittable>> primitives;
+        aabb bbox;
+
+        static std::unique_ptr<bvh8_node, free_deleter> aligned_nodes(std::vector<bvh8_node>& built) {
+            void* memory = nullptr;
+            if (posix_memalign(&memory, 64, built.size() * sizeof(bvh8_node)) != 0) {
+                throw std::bad_alloc();
+            }
+            std::memcpy(memory, built.data(), built.size() * sizeof(bvh8_node));
+            built.clear();
+            built.shrink_to_fit();
+            return std::unique_ptr<bvh8_node, free_deleter>(static_cast<bvh8_node*>(memory));
+        }
+
+        static double half_area(const aabb& b) {
+            auto dx = b.x.size(), dy = b.y.size(), dz = b.z.size();
+            return dx * dy + dy * dz + dz * dx;
+        }
+
+        static const bvh_node* as_inner(const shared_ptr<hittable>& h) {
+            auto node = dynamic_cast<const bvh_node*>(h.get());
+            return (node && node->left_child() != node->right_child()) ? node : nullptr;
+        }
+
+        static shared_ptr<hittable> unwrap(const shared_ptr<hittable>& h) {
+            // single-object binary leaves hold their object in both children.
+            auto node = dynamic_cast<const bvh_node*>(h.get());
+            return (node && node->left_child() == node->right_child()) ? unwrap(node->left_child()) : h;
+        }
+
+        void collapse(const bvh_node& source, size_t index) {
+            std::vector<shared_ptr<hittable>> children;
+            if (source.left_child() == source.right_child()) {
+                children.push_back(unwrap(source.left_child()));
+            } else {
+                children.push_back(unwrap(source.left_child()));
+                children.push_back(unwrap(source.right_child()));
+            }
+
+            while (children.size() < 8) {
+                int best = -1;
+                double best_area = -1;
+                for (size_t c = 0; c < children.size(); ++c) {
+                    if (as_inner(children[c]) && half_area(children[c]->bounding_box()) > best_area) {
+                        best = static_cast<int>(c);
+                        best_area = half_area(children[c]->bounding_box());
+                    }
+                }
+                if (best < 0) break;
+
+                auto opened = as_inner(children[best]);
+                auto l = unwrap(opened->left_child());
+                auto r = unwrap(opened->right_child());
+                children[best] = l;
+                children.push_back(r);
+            }
+
+            aabb parent;
+            for (const auto& c : children) {
+                parent = aabb(parent, c->bounding_box());
+            }
+            quantize(index, parent, children);
+
+            for (size_t c = 0; c < children.size(); ++c) {
+                if (auto inner = as_inner(children[c])) {
+                    size_t child_index = nodes.size();
+                    nodes.emplace_back();
+                    nodes[index].child[c] = static_cast<int32_t>(child_index);
+                    collapse(*inner, child_index);
+                } else {
+                    nodes[index].child[c] = ~static_cast<int32_t>(primitives.size());
+                    primitives.push_back(children[c]);
+                }
+            }
+        }
+
+        void quantize(size_t index, const aabb& parent, const std::vector<shared_ptr<hittable>>& children) {
+            bvh8_node& node = nodes[index];
+            std::memset(&node, 0, sizeof(node));
+            node.child_count = static_cast<uint8_t>(children.size());
+
+            for (int a = 0; a < 3; ++a) {
+                const interval& extent = parent.axis(a);
+
+                // origin rounded down so every child box starts at or after it.
+                float origin = static_cast<float>(extent.min);
+                if (origin > extent.min) origin = std::nextafter(origin, -std::numeric_limits<float>::infinity());
+
+                int e = static_cast<int>(std::ceil(std::log2(fmax((extent.max - origin) / 255.0, 1e-30))));
+                e = std::max(-127, std::min(127, e));
+                double step = std::ldexp(1.0, e);
+
+                node.origin[a] = origin;
+                node.exponent[a] = static_cast<int8_t>(e);
+
+                for (size_t c = 0; c < children.size(); ++c) {
+                    interval box = children[c]->bounding_box().axis(a);
+                    auto lo = std::floor((box.min - origin) / step);
+                    auto hi = std::ceil((box.max - origin) / step);
+                    node.lo[a][c] = static_cast<uint8_t>(std::max(0.0, std::min(255.0, lo)));
+                    node.hi[a][c] = static_cast<uint8_t>(std::max(0.0, std::min(255.0, hi)));
+                }
+            }
+        }
+
+        // Tests all children of 'node', returns a bit mask of the boxes hit and their entry
+        // distances in 'tnear'. The far distance is scaled up a little so float rounding in the
+        // decode and the slab test never drops a box the ray really touches.
+        static unsigned intersect_children(const bvh8_node& node, const float org[3], const float inv[3],
+                                           float tmin, float tmax, float tnear[8]) {
+            const float robust = 1.0f + 4 * std::numeric_limits<float>::epsilon();
+#if defined(__AVX2__)
+            __m256 t_enter = _mm256_set1_ps(tmin);
+            __m256 t_exit  = _mm256_set1_ps(tmax);
+            for (int a = 0; a < 3; ++a) {
+                // near and far planes swap when the ray runs towards -axis.
+                const uint8_t* near_q = inv[a] >= 0 ? node.lo[a] : node.hi[a];
+                const uint8_t* far_q  = inv[a] >= 0 ? node.hi[a] : node.lo[a];
+                __m256 qn = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(near_q))));
+                __m256 qf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(far_q))));
+
+                // t = (origin + q*scale - org) * inv. The plane offset is formed before the
+                // multiply, so a zero direction (inv = +-inf) gives +-inf rather than NaN, and
+                // the one NaN left (ray exactly on a plane) is passed first to max/min, which
+                // then return the other operand: that slab doesn't cull, as in the scalar path.
+                __m256 s = _mm256_set1_ps(std::ldexp(1.0f, node.exponent[a]));
+                __m256 b = _mm256_set1_ps(node.origin[a] - org[a]);
+                __m256 i = _mm256_set1_ps(inv[a]);
+                t_enter = _mm256_max_ps(_mm256_mul_ps(_mm256_fmadd_ps(qn, s, b), i), t_enter);
+                t_exit  = _mm256_min_ps(_mm256_mul_ps(_mm256_fmadd_ps(qf, s, b), i), t_exit);
+            }
+            t_exit = _mm256_mul_ps(t_exit, _mm256_set1_ps(robust));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ)));
+            _mm256_storeu_ps(tnear, t_enter);
+            return mask & ((1u << node.child_count) - 1);
+#else
+            unsigned mask = 0;
+            for (int c = 0; c < node.child_count; ++c) {
+                float t_enter = tmin, t_exit = tmax;
+                for (int a = 0; a < 3; ++a) {
+                    const float scale = std::ldexp(1.0f, node.exponent[a]);
+                    float n = (inv[a] >= 0 ? node.lo[a][c] : node.hi[a][c]) * scale + node.origin[a];
+                    float f = (inv[a] >= 0 ? node.hi[a][c] : node.lo[a][c]) * scale + node.origin[a];
+                    t_enter = std::max(t_enter, (n - org[a]) * inv[a]);
+                    t_exit  = std::min(t_exit,  (f - org[a]) * inv[a]);
+                }
+                tnear[c] = t_enter;
+                if (t_enter <= t_exit * robust) mask |= 1u << c;
+            }
+            return mask;
+#endif
+        }
+
+        // Closest hit, or with any_hit set, the first blocker found (t and prim left unset).
+        bool traverse(const ray& r, interval ray_t, bool any_hit, double& t, const hittable*& prim) const {
+            const bvh8_node* data = node_data.get();
+
+            float org[3], inv[3];
+            for (int a = 0; a < 3; ++a) {
+                org[a] = static_cast<float>(r.orig[a]);
+                inv[a] = static_cast<float>(1.0 / r.dir[a]);
+            }
+
+            int32_t stack[64 * 8];
+            int stack_size = 0;
+            stack[stack_size++] = 0;
+            bool hit_anything = false;
+
+            while (stack_size > 0) {
+                int32_t entry = stack[--stack_size];
+
+                if (entry < 0) {
+                    const hittable& leaf = *primitives[~entry];
+                    if (any_hit) {
+                        if (leaf.occluded(r, ray_t)) return true;
+                    } else if (leaf.intersect(r, ray_t, t, prim)) {
+                        hit_anything = true;
+                        ray_t.max = t;
+                    }
+                    continue;
+                }
+
+                const bvh8_node& node = data[entry];
+                float tnear[8];
+                unsigned mask = intersect_children(node, org, inv, static_cast<float>(ray_t.min),
+                                                   static_cast<float>(fmin(ray_t.max, 3.0e38)), tnear);
+
+                // push far to near, so the nearest child is popped first.
+                int order[8], count = 0;
+                for (int c = 0; c < 8; ++c) {
+                    if (!(mask & (1u << c))) continue;
+                    int k = count++;
+                    while (k > 0 && tnear[order[k-1]] < tnear[c]) {
+                        order[k] = order[k-1];
+                        --k;
+                    }
+                    order[k] = c;
+                }
+                for (int k = 0; k < count; ++k) {
+                    stack[stack_size++] = node.child[order[k]];
+                }
+            }
+            return hit_anything;
+        }
+};
+
+#endif
@@ -0,0 +1,87 @@
+// Radiance cache check: threads add samples and look them up at the same time, the way
+// render threads do. Every sample in a cluster of points carries the radiance of its
+// cluster and face, so a lookup has to return exactly that value once the writers are
+// done, and while they run it may only overshoot by the few adds whose sums landed before
+// their count (sums and count are separate atomics). A small table makes the probing and
+// the table-full path run as well.
+//
+// Usage: ./cache_check        prints the lookups per phase, exits 1 on a wrong value
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+#include "mlem.h"
+#include "radiance_cache.h"
+#include "vec3.h"
+
+const int threads = 4;
+const int clusters = 6;
+const int min_samples = 16;
+
+point3 cluster_center(int c) {
+    return point3(10 * std::cos(c), 1.5 * c - 4, 10 * std::sin(c));
+}
+
+// exactly representable, so float sums of up to max_samples of them stay exact.
+double cluster_value(int c, int face) {
+    return 0.25 * (1 + c) + 0.0625 * face;
+}
+
+const vec3 face_normals[2] = {vec3(0, 1, 0), vec3(1, 0, 0)};
+
+int main() {
+    radiance_cache cache(0.01, 512, min_samples, 256);
+    cache.set_viewpoint(point3(0, 0, 0));
+
+    std::vector<long> found(threads, 0), wrong(threads, 0);
+    auto check = [&](int t, int c, int face, const color& got, bool writers_done) {
+        double v = cluster_value(c, face);
+        // in flight: at most one unfinished add per other thread on top of the count.
+        double high = writers_done ? v : v * (min_samples + threads) / min_samples;
+        for (int k = 0; k < 3; ++k) {
+            if (!(got[k] >= v - 1e-6 && got[k] <= high + 1e-6)) {
+                ++wrong[t];
+                return;
+            }
+        }
+        ++found[t];
+    };
+
+    auto worker = [&](int t, bool write) {
+        std::mt19937 rng(100 + t);
+        std::uniform_real_distribution<double> u(-0.25, 0.25);
+        for (int k = 0; k < 200000; ++k) {
+            int c = (k / 2) % clusters, face = (k / (2 * clusters)) % 2;
+            point3 p = cluster_center(c) + vec3(u(rng), u(rng), u(rng));
+            if (write && k % 2 == 0) {
+                double v = cluster_value(c, face);
+                cache.add(p, face_normals[face], color(v, v, v));
+            } else {
+                color got;
+                if (cache.lookup(p, face_normals[face], got)) {
+                    check(t, c, face, got, !write);
+                }
+            }
+        }
+    };
+
+    // phase one: everyone adds and looks up; phase two: lookups only, after the join.
+    long phase_found[2] = {0, 0}, phase_wrong[2] = {0, 0};
+    for (int phase = 0; phase < 2; ++phase) {
+        std::fill(found.begin(), found.end(), 0);
+        std::fill(wrong.begin(), wrong.end(), 0);
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t) pool.emplace_back(worker, t, phase == 0);
+        for (auto& th : pool) th.join();
+        for (int t = 0; t < threads; ++t) {
+            phase_found[phase] += found[t];
+            phase_wrong[phase] += wrong[t];
+        }
+    }
+
+    bool ok = phase_wrong[0] == 0 && phase_wrong[1] == 0 && phase_found[1] > 0;
+    std::printf("concurrent  %ld lookups answered, %ld wrong\n", phase_found[0], phase_wrong[0]);
+    std::printf("after join  %ld lookups answered, %ld wrong%s\n", phase_found[1], phase_wrong[1], ok ? "" : "  FAIL");
+    return ok ? 0 : 1;
+}
@@ -8,45 +8,21 @@
 #include "ray.h"
 #include "hittable_list.h"
 #include "material.h"
-
+#include "light.h"
+#include "denoise.h"
+#include "thread_pool.h"
+#include "tiff.h"
+#include "radiance_cache.h"
+#include "photon_map.h"
+
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <vector>
 #include <thread>
 #include <mutex>
 #include <atomic>
-#include <condition_variable>
-#include <queue>
-
-// Task queue for better work distribution
-class TaskQueue {
-        std::queue<std::pair<int, int>> tasks;
-        std::mutex mutex;
-        std::condition_variable cv;
-        bool done = false;
-
-    public:
-        void push(std::pair<int, int> task) {
-            std::unique_lock<std::mutex> lock(mutex);
-            tasks.push(task);
-            cv.notify_one();
-        }
-
-        bool pop(std::pair<int, int>& task) {
-            std::unique_lock<std::mutex> lock(mutex);
-            if (tasks.empty() && !done) cv.wait(lock);
-            if (tasks.empty() && done) return false;
-            task = tasks.front();
-            tasks.pop();
-            return true;
-        }
-
-        void finish() {
-            std::unique_lock<std::mutex> lock(mutex);
-            done = true;
-            cv.notify_all();
-        }
-};
+#include <functional>
 
 class camera {
     public:
@@ -55,6 +31,7 @@ class camera {
         int    max_depth         =  10;  // maximum number of ray bounces into world.
         int    samples_per_pixel =  10;  // Count of random samples for each pixel
         int    block_size        =  64;
+        int    num_threads       =   0;  // Render threads, 0 = 1.5 per hardware thread (see autotune.h).
 
         double vfov = 90;                // Vertical FOV
         point3 lookfrom = point3(0,0,0); // Point camera is looking from
@@ -64,109 +41,259 @@ class camera {
         double defocus_angle = 0;        // Variation angle of rays through each pixel.
         double focus_dist = 10;          // Distance from camera lookfrom point to plane of perfect focus
 
+        double shutter_open  = 0;        // Shutter interval, in the [0,1] time range objects move over.
+        double shutter_close = 0;        // Equal to shutter_open means no motion blur.
+
+        double time_budget = 0;          // Wall-clock seconds per frame. When > 0 it replaces samples_per_pixel.
+
+        bool   show_progress = true;     // Progress percentage on std::clog while rendering.
+        bool   numa_aware = false;       // Pin render threads per NUMA node, each node owns a band of blocks.
+        bool   raster_primary = false;   // Find first hits by rasterizing primitives per block instead of
+                                         // tracing camera rays. Pinhole only, traced when defocus or motion blur is on.
+
+        shared_ptr<radiance_cache> cache; // Optional diffuse radiance cache, filled while rendering and
+        int    cache_bounce = 1;         // read by diffuse hits from this bounce on (0 = camera hits).
+
+        int    caustic_photons = 0;      // Photons shot from the lights for the caustic map, 0 = off.
+        int    caustic_k       = 64;     // Nearest photons in each caustic density estimate,
+        double caustic_radius  = 0.1;    // gathered from no farther than this.
+                                         // The map is kept while the world, the lights (by address)
+                                         // and the settings it was shot with stay the same.
+
+        bool   write_aovs = false;       // Fill 'aovs' with first-hit albedo, normal and depth.
+        bool   denoise    = false;       // Run the a-trous denoiser on the frame (implies write_aovs).
+        denoise_settings denoiser;
+        aov_buffers aovs;                // Feature buffers of the last rendered frame.
 
         void render(const hittable& world) {
-            initialize();
+            render(world, light_list());
+        }
+
+        void render(const hittable& world, const light_list& lights) {
+            color_buffer framebuffer;
+            render_frame(world, lights, framebuffer);
 
-            std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+            // Output the image
+            write_image(std::cout, framebuffer);
+
+            std::clog << "\nRendering complete.\n";
+        }
+
+        // Renders one frame into 'framebuffer' (resized to image_width * image_height).
+        // The worker threads are kept alive between calls, so rendering several frames
+        // from the same camera only pays for thread start-up once. The buffer isn't cleared
+        // here, each pixel is first written by the thread that renders its block.
+        void render_frame(const hittable& world, const light_list& lights, color_buffer& framebuffer) {
+            if (time_budget > 0) {
+                render_budgeted(world, lights, framebuffer);
+                return;
+            }
 
-            std::vector<color> framebuffer(image_width * image_height);
+            initialize();
+            prepare_caustics(world, lights);
+
+            framebuffer.resize(image_width * image_height);
+            const bool collect_aovs = write_aovs || denoise;
+            if (collect_aovs) {
+                aovs.resize(framebuffer.size());
+            }
             std::atomic<int> blocks_remaining{0};
             std::mutex cout_mutex;
-            TaskQueue task_queue;
 
             // Calculate blocks with overlap for better cache utilization
             int num_blocks_x = (image_width + block_size - 1) / block_size;
             int num_blocks_y = (image_height + block_size - 1) / block_size;
             blocks_remaining = num_blocks_x * num_blocks_y;
 
-            // Pre-calculate some common values
-            const double inv_width = 1.0 / image_width;
-            const double inv_height = 1.0 / image_height;
+            // Pick the render_block instantiation for this frame's options once, so the
+            // per-sample loop runs without them.
+            const bool motion_blur = shutter_close > shutter_open;
+            const block_kernel kernel = pick_kernel(defocus_angle > 0, motion_blur, collect_aovs, !lights.empty());
+
+            // The raster pre-pass bins primitives to blocks by their screen rectangles once per frame.
+            const bool raster = raster_primary && defocus_angle <= 0 && !motion_blur && max_depth > 0;
+            raster_bins bins;
+            raster_kernel rkernel = nullptr;
+            if (raster) {
+                bin_primitives(world, num_blocks_x, num_blocks_y, bins);
+                rkernel = collect_aovs ? (lights.empty() ? &camera::raster_block<true, false> : &camera::raster_block<true, true>)
+                                       : (lights.empty() ? &camera::raster_block<false, false> : &camera::raster_block<false, true>);
+            }
 
             // Enhanced worker function with local cache
-            auto worker = [&]() {
-                // Pre-allocate arrays for the entire block
-                std::vector<ray> rays(block_size * block_size * samples_per_pixel);
-                std::vector<color> block_colors(block_size * block_size);
-                std::pair<int, int> block;
-
-                while (task_queue.pop(block)) {
-                    int block_x = block.first;
-                    int block_y = block.second;
-                    
-                    // Calculate block boundaries
-                    int start_x = block_x * block_size;
-                    int start_y = block_y * block_size;
-                    int end_x = std::min(start_x + block_size, image_width);
-                    int end_y = std::min(start_y + block_size, image_height);
-                    
-                    // Process entire block
-                    #pragma omp parallel for collapse(2) if(block_size >= 32)
-                    for (int j = start_y; j < end_y; ++j) {
-                        for (int i = start_x; i < end_x; ++i) {
-                            color pixel_color(0, 0, 0);
-                            int local_idx = (j - start_y) * block_size + (i - start_x);
-                            
-                            // Generate and process all rays for this pixel
-                            for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                                auto offset = sample_square();
-                                auto pixel_sample = pixel00_loc + 
-                                                  (i + offset.x()) * pixel_delta_u +
-                                                  (j + offset.y()) * pixel_delta_v;
-
-                                auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
-                                auto ray_direction = pixel_sample - ray_origin;
-                                
-                                ray r(ray_origin, ray_direction);
-                                pixel_color += ray_color(r, max_depth, world);
-                            }
-                            
-                            framebuffer[j * image_width + i] = pixel_samples_scale * pixel_color;
-                        }
-                    }
+            auto worker = [&](int block_index) {
+                int block_x = block_index % num_blocks_x;
+                int block_y = block_index / num_blocks_x;
+
+                // Calculate block boundaries
+                int start_x = block_x * block_size;
+                int start_y = block_y * block_size;
+                int end_x = std::min(start_x + block_size, image_width);
+                int end_y = std::min(start_y + block_size, image_height);
+
+                color* out = &framebuffer[start_y * image_width + start_x];
+                if (raster) {
+                    (this->*rkernel)(start_x, start_y, end_x, end_y, world, lights, bins, bins.blocks[block_index],
+                                     out, image_width);
+                } else {
+                    (this->*kernel)(start_x, start_y, end_x, end_y, world, lights, out, image_width);
+                }
 
-                    // Update progress less frequently
-                    if (--blocks_remaining % 5 == 0) {
-                        std::lock_guard<std::mutex> lock(cout_mutex);
-                        std::clog << "\rProgress: " << 
-                            static_cast<int>((1.0 - (blocks_remaining / static_cast<double>(num_blocks_x * num_blocks_y))) * 100) 
-                            << "% " << std::flush;
-                    }
+                // Update progress less frequently
+                if (--blocks_remaining % 5 == 0 && show_progress) {
+                    std::lock_guard<std::mutex> lock(cout_mutex);
+                    std::clog << "\rProgress: " <<
+                        static_cast<int>((1.0 - (blocks_remaining / static_cast<double>(num_blocks_x * num_blocks_y))) * 100)
+                        << "% " << std::flush;
                 }
             };
 
-            // Optimize thread count based on hardware and block size
-            const int num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency() * 1.5));
-            std::vector<std::thread> threads;
+            // Blocks are handed out row by row, in a cache-friendly order.
+            workers().run(num_blocks_x * num_blocks_y, worker);
 
-            // Push tasks in a more cache-friendly order
-            for (int by = 0; by < num_blocks_y; ++by) {
-                for (int bx = 0; bx < num_blocks_x; ++bx) {
-                    task_queue.push({bx, by});
-                }
+            if (denoise) {
+                atrous_denoise(framebuffer, image_width, image_height, aovs, workers(), denoiser);
             }
+        }
 
-            // Launch threads with high priority
-            threads.reserve(num_threads);
-            for (int t = 0; t < num_threads; ++t) {
-                threads.emplace_back(worker);
+        // Pixels of one finished tile: origin (x0, y0), size w x h, rows 'stride' apart.
+        // The pointer is only valid during the call.
+        using tile_callback = std::function<void(int x0, int y0, int w, int h, const color* pixels, int stride)>;
+
+        // Renders the frame tile by tile and hands each finished tile to 'on_tile', from the
+        // render thread that made it (so it has to be thread safe). Only the tiles in flight
+        // are held, about threads x tile_size^2 pixels. Raising 'cancel' skips the tiles not
+        // started yet, the result is then false. time_budget and denoise need the whole frame
+        // and aren't applied.
+        bool render_tiles(const hittable& world, const light_list& lights, int tile_size,
+                          const tile_callback& on_tile, const std::atomic<bool>* cancel = nullptr) {
+            initialize();
+            prepare_caustics(world, lights);
+
+            const int tile = std::max(1, tile_size);
+            const int tiles_x = (image_width + tile - 1) / tile;
+            const int tile_count = tiles_x * ((image_height + tile - 1) / tile);
+
+            const bool motion_blur = shutter_close > shutter_open;
+            const block_kernel kernel = pick_kernel(defocus_angle > 0, motion_blur, false, !lights.empty());
+
+            std::atomic<int> tiles_done{0};
+            std::mutex cout_mutex;
+
+            workers().run(tile_count, [&](int index) {
+                if (cancel && cancel->load(std::memory_order_relaxed)) {
+                    return;
+                }
+                thread_local std::vector<color> accum;
+                accum.resize(size_t(tile) * tile);
+
+                int start_x = (index % tiles_x) * tile;
+                int start_y = (index / tiles_x) * tile;
+                int end_x = std::min(start_x + tile, image_width);
+                int end_y = std::min(start_y + tile, image_height);
+                (this->*kernel)(start_x, start_y, end_x, end_y, world, lights, accum.data(), tile);
+                on_tile(start_x, start_y, end_x - start_x, end_y - start_y, accum.data(), tile);
+
+                int done = ++tiles_done;
+                if (show_progress && done % 16 == 0) {
+                    std::lock_guard<std::mutex> lock(cout_mutex);
+                    std::clog << "\rProgress: " << done * 100 / tile_count << "% " << std::flush;
+                }
+            });
+
+            return !(cancel && cancel->load());
+        }
+
+        // Out-of-core render for images too large to hold: finished tiles are quantized and
+        // written straight into a tiled TIFF at 'path' (BigTIFF past 4 GB).
+        bool render_tiled(const hittable& world, const light_list& lights, const std::string& path,
+                          int tile_size = 256) {
+            tiled_tiff_writer out;
+            if (!out.open(path, image_width, output_height(), tile_size)) {
+                std::cerr << "Can't write " << path << std::endl;
+                return false;
             }
+            const int tile = out.tile_width();
+            std::atomic<bool> ok{true};
+
+            render_tiles(world, lights, tile, [&](int x0, int y0, int w, int h, const color* pixels, int stride) {
+                thread_local std::vector<uint8_t> bytes;
+                bytes.assign(size_t(tile) * tile * 3, 0); // padding past the image edge stays black
+                for (int y = 0; y < h; ++y) {
+                    for (int x = 0; x < w; ++x) {
+                        const color& c = pixels[y * stride + x];
+                        uint8_t* px = &bytes[3 * (y * tile + x)];
+                        px[0] = static_cast<uint8_t>(quantize_channel(c.x()));
+                        px[1] = static_cast<uint8_t>(quantize_channel(c.y()));
+                        px[2] = static_cast<uint8_t>(quantize_channel(c.z()));
+                    }
+                }
+                if (!out.write_tile(x0 / tile, y0 / tile, bytes.data())) {
+                    ok = false;
+                }
+            });
+
+            return out.close() && ok;
+        }
 
-            task_queue.finish();
+        // Drops the caustic photon map, call after editing the world or the lights in place.
+        void reset_caustics() {
+            caustics.reset();
+        }
+
+        // A copied camera shares the original's worker threads. Call this on the copy before
+        // rendering with both at the same time, it then starts its own.
+        void separate_workers() {
+            pool.reset();
+        }
 
-            for (auto& thread : threads) {
-                thread.join();
+        // Image height for the current image_width and aspect_ratio.
+        int output_height() const {
+            return std::max(1, int(image_width / aspect_ratio));
+        }
+
+        // Renders only the crop [x0, x0+w) x [y0, y0+h) of the full image at 'spp' samples per
+        // pixel into 'tile' (row major, w * h). Used for quick look-dev updates of small regions.
+        // The crop is cut into block_size blocks for the same kernels render_frame() runs.
+        // Returns false, with 'tile' empty, if the crop isn't a non-empty part of the image.
+        bool render_region(const hittable& world, const light_list& lights, int x0, int y0, int w, int h,
+                           int spp, std::vector<color>& tile) {
+            tile.clear();
+            if (image_width <= 0 || !(aspect_ratio > 0) || w <= 0 || h <= 0 || spp <= 0
+                || x0 < 0 || y0 < 0 || x0 > image_width - w || y0 > output_height() - h) {
+                return false;
             }
+            const int saved_spp = samples_per_pixel;
+            samples_per_pixel = spp;
+            initialize();
+            prepare_caustics(world, lights);
+
+            tile.assign(size_t(w) * h, color(0,0,0));
+            const int block = std::max(1, block_size);
+            const int blocks_x = (w + block - 1) / block;
+            const int blocks_y = (h + block - 1) / block;
+            const bool motion_blur = shutter_close > shutter_open;
+            const block_kernel kernel = pick_kernel(defocus_angle > 0, motion_blur, false, !lights.empty());
+
+            workers().run(blocks_x * blocks_y, [&](int index) {
+                int start_x = x0 + (index % blocks_x) * block;
+                int start_y = y0 + (index / blocks_x) * block;
+                int end_x = std::min(start_x + block, x0 + w);
+                int end_y = std::min(start_y + block, y0 + h);
+                (this->*kernel)(start_x, start_y, end_x, end_y, world, lights,
+                                &tile[size_t(start_y - y0) * w + (start_x - x0)], w);
+            });
+            samples_per_pixel = saved_spp;
+            return true;
+        }
 
-            // Output the image
+        void write_image(std::ostream& out, const color_buffer& framebuffer) const {
+            out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
             for (int j = 0; j < image_height; ++j) {
                 for (int i = 0; i < image_width; ++i) {
-                    write_color(std::cout, framebuffer[j * image_width + i]);
+                    write_color(out, framebuffer[j * image_width + i]);
                 }
             }
-
-            std::clog << "\nRendering complete.\n";
         }
 
     private:
@@ -176,17 +303,71 @@ class camera {
         point3  pixel00_loc;     // Locagtion of pixel 0, 0
         vec3    pixel_delta_u;   // Offset to pixel to the right
         vec3    pixel_delta_v;   // Offset to pixel bellow
+        double  pixel_spread;    // Cone angle of camera rays, for texture filtering
+        double  diffuse_spread = 0.05; // Cone angle after a diffuse bounce, which blurs texture detail anyway
         vec3    u, v, w;         // Camera frame basis vectors. 
         vec3    defocus_disk_u;  // Defocus dick horizontal radius;
         vec3    defocus_disk_v;  // Defocus dick vertical radius;
+        shared_ptr<thread_pool> pool;  // Render threads, started on first use
+        shared_ptr<photon_map> caustics; // Caustic photons, null when off
+
+        // What the caustic map was shot for, it is reused while this matches.
+        struct caustics_key {
+            const hittable* world = nullptr;
+            const light_list* lights = nullptr;
+            size_t light_count = 0;
+            int photons = 0, max_depth = 0;
+            double shutter_open = 0, shutter_close = 0;
+
+            bool operator==(const caustics_key& o) const {
+                return world == o.world && lights == o.lights && light_count == o.light_count
+                    && photons == o.photons && max_depth == o.max_depth
+                    && shutter_open == o.shutter_open && shutter_close == o.shutter_close;
+            }
+        };
+        caustics_key caustics_for;
+
+        void prepare_caustics(const hittable& world, const light_list& lights) {
+            if (caustic_photons <= 0 || lights.empty()) {
+                caustics.reset();
+                return;
+            }
+            caustics_key key;
+            key.world = &world;
+            key.lights = &lights;
+            key.light_count = lights.lights.size();
+            key.photons = caustic_photons;
+            key.max_depth = max_depth;
+            key.shutter_open = shutter_open;
+            key.shutter_close = std::max(shutter_open, shutter_close);
+            if (caustics && key == caustics_for) {
+                return;
+            }
+            caustics = make_shared<photon_map>();
+            caustics->emit(world, lights, caustic_photons, max_depth, key.shutter_open, key.shutter_close, workers());
+            caustics_for = key;
+        }
+
+        thread_pool& workers() {
+            // oversubscribe a little by default so blocks with cheap pixels don't leave cores idle.
+            const int threads = num_threads > 0
+                              ? num_threads
+                              : std::max(1, static_cast<int>(std::thread::hardware_concurrency() * 1.5));
+            if (!pool || pool->numa_pinned() != numa_aware || pool->size() != threads) {
+                pool = make_shared<thread_pool>(threads, numa_aware);
+            }
+            return *pool;
+        }
 
         void initialize() {
-            image_height = int(image_width / aspect_ratio);
-            image_height = (image_height < 1) ? 1 : image_height;
+            image_height = output_height();
 
             pixel_samples_scale = 1.0 / samples_per_pixel;
 
             center = lookfrom;
+            if (cache) {
+                cache->set_viewpoint(center);
+            }
 
             // Determine viewport dimensions.
             // auto focal_length = (lookfrom - lookat).length();
@@ -208,6 +389,8 @@ class camera {
             // Calculate the horizontal and vertical delta vectors from pixel to pixel.
             pixel_delta_u = viewport_u / image_width;
             pixel_delta_v = viewport_v / image_height;
+            // camera rays start as cones one pixel wide per unit of distance along the view axis.
+            pixel_spread = pixel_delta_v.length() / focus_dist;
 
             // Calculate the location of the upper left pixel.
             auto viewport_upper_left = center - (focus_dist * w) - viewport_u/2 - viewport_v/2;
@@ -219,7 +402,446 @@ class camera {
             defocus_disk_v = v * defocus_radius;
         }
 
-        color ray_color (const ray& r, int depth, const hittable& world) const { 
+        // Time-budgeted frame. A first pass at one sample per pixel goes coarse to fine (every
+        // 8th pixel, then every 4th, ...) and stops at the deadline, so the whole frame is
+        // covered, blockily if the budget is tiny. Up to first_spp samples per pixel follow
+        // while under a quarter of the budget, which measures the cost of a sample and the
+        // noise of every tile. Then rounds of extra samples go to the noisiest tiles, each
+        // round sized to about half of the time left, until the budget is spent. Work is
+        // handed out by rows or tiles, and each one checks the clock before it starts, so
+        // the frame ends within a row or tile per thread of the deadline. Pixels are
+        // normalized by their own sample counts; ones the coarse pass never reached copy the
+        // nearest coarser pixel that was sampled.
+        void render_budgeted(const hittable& world, const light_list& lights, color_buffer& framebuffer) {
+            using clock = std::chrono::steady_clock;
+            const auto start = clock::now();
+            auto elapsed = [&start]() { return std::chrono::duration<double>(clock::now() - start).count(); };
+            const double budget = time_budget;
+
+            initialize();
+            prepare_caustics(world, lights);
+
+            const size_t n = size_t(image_width) * image_height;
+            framebuffer.assign(n, color(0,0,0));
+            aovs.resize(n);
+            std::vector<pixel_sums> pixels(n);
+            std::vector<int> counts(n, 0);
+
+            auto sample_pixel = [&](int i, int j) {
+                size_t k = size_t(j) * image_width + i;
+                aov_sample aov;
+                ray r = get_ray(i, j);
+                color c = lights.empty() ? ray_color<false>(r, max_depth, world, lights, 0, &aov)
+                                         : ray_color<true>(r, max_depth, world, lights, 0, &aov);
+                pixels[k].add(c, aov);
+                counts[k]++;
+            };
+
+            // coarse to fine: a pixel on the stride s grid not already on the 2s grid.
+            const int coarsest = 8;
+            for (int stride = coarsest; stride >= 1; stride /= 2) {
+                workers().run((image_height + stride - 1) / stride, [&](int row) {
+                    if (elapsed() >= budget) return;
+                    int j = row * stride;
+                    bool coarse_row = stride < coarsest && j % (2 * stride) == 0;
+                    for (int i = 0; i < image_width; i += stride) {
+                        if (!(coarse_row && i % (2 * stride) == 0)) sample_pixel(i, j);
+                    }
+                });
+            }
+
+            const int first_spp = 4;
+            for (int pass = 1; pass < first_spp; ++pass) {
+                workers().run(image_height, [&](int j) {
+                    if (elapsed() >= 0.25 * budget) return;
+                    for (int i = 0; i < image_width; ++i) sample_pixel(i, j);
+                });
+            }
+
+            double samples_done = 0;
+            bool covered = true;
+            for (size_t k = 0; k < n; ++k) {
+                samples_done += counts[k];
+                covered = covered && counts[k] > 0;
+            }
+
+            // adaptive tiles are kept small so the samples can follow the noise closely.
+            const int tile = std::min(block_size, 16);
+            const int num_tiles_x = (image_width + tile - 1) / tile;
+            const int num_tiles_y = (image_height + tile - 1) / tile;
+            const int num_tiles = num_tiles_x * num_tiles_y;
+            auto tile_bounds = [&](int t, int& x0, int& y0, int& x1, int& y1) {
+                x0 = (t % num_tiles_x) * tile;
+                y0 = (t / num_tiles_x) * tile;
+                x1 = std::min(x0 + tile, image_width);
+                y1 = std::min(y0 + tile, image_height);
+            };
+
+            double seconds_per_sample = elapsed() / fmax(samples_done, 1.0);
+            std::vector<double> tile_sigma(num_tiles), tile_current(num_tiles), tile_extra(num_tiles);
+            std::vector<int>    tile_pixels(num_tiles), tile_spp(num_tiles);
+            std::vector<int>    scheduled;
+
+            while (covered) {
+                double remaining = budget - elapsed();
+                double round_samples = 0.5 * remaining / seconds_per_sample;
+                if (remaining <= 0 || round_samples < num_tiles) {
+                    break;
+                }
+
+                // Minimizing the summed variance sum(sigma^2 / spp) for a fixed sample count
+                // means spp proportional to sigma, the relative per-sample deviation of a tile.
+                double weighted_pixels = 0;
+                for (int t = 0; t < num_tiles; ++t) {
+                    int x0, y0, x1, y1;
+                    tile_bounds(t, x0, y0, x1, y1);
+                    double rel_var = 0, tile_samples = 0;
+                    for (int j = y0; j < y1; ++j) {
+                        for (int i = x0; i < x1; ++i) {
+                            size_t k = size_t(j) * image_width + i;
+                            double mean = pixels[k].lum_sum / counts[k];
+                            rel_var += fmax(0.0, pixels[k].lum_sq_sum / counts[k] - mean * mean) / (mean * mean + 1e-3);
+                            tile_samples += counts[k];
+                        }
+                    }
+                    tile_pixels[t] = (x1 - x0) * (y1 - y0);
+                    tile_sigma[t] = sqrt(rel_var / tile_pixels[t]);
+                    tile_current[t] = tile_samples / tile_pixels[t];
+                    weighted_pixels += tile_sigma[t] * tile_pixels[t];
+                }
+                if (weighted_pixels <= 0) {
+                    break;
+                }
+
+                // extra samples per pixel that move each tile towards its share of the new total.
+                double extra_total = 0;
+                for (int t = 0; t < num_tiles; ++t) {
+                    double target = (samples_done + round_samples) * tile_sigma[t] / weighted_pixels;
+                    tile_extra[t] = fmax(0.0, target - tile_current[t]);
+                    extra_total += tile_extra[t] * tile_pixels[t];
+                }
+                if (extra_total <= 0) {
+                    break;
+                }
+
+                // scaled to the round's budget, rounded stochastically.
+                scheduled.clear();
+                for (int t = 0; t < num_tiles; ++t) {
+                    double spp = tile_extra[t] * round_samples / extra_total;
+                    tile_spp[t] = static_cast<int>(spp) + (random_double() < spp - std::floor(spp) ? 1 : 0);
+                    if (tile_spp[t] > 0) {
+                        scheduled.push_back(t);
+                    }
+                }
+                if (scheduled.empty()) {
+                    break;
+                }
+
+                auto round_start = elapsed();
+                std::atomic<long long> round_done{0};
+                workers().run(static_cast<int>(scheduled.size()), [&](int task) {
+                    if (elapsed() >= budget) return;
+                    int t = scheduled[task];
+                    int x0, y0, x1, y1;
+                    tile_bounds(t, x0, y0, x1, y1);
+                    for (int j = y0; j < y1; ++j) {
+                        for (int i = x0; i < x1; ++i) {
+                            for (int sample = 0; sample < tile_spp[t]; ++sample) {
+                                sample_pixel(i, j);
+                            }
+                        }
+                    }
+                    round_done += static_cast<long long>(tile_spp[t]) * tile_pixels[t];
+                });
+                if (round_done == 0) {
+                    break;
+                }
+                seconds_per_sample = (elapsed() - round_start) / round_done;
+                samples_done += round_done;
+            }
+
+            for (size_t k = 0; k < n; ++k) {
+                if (counts[k] == 0) continue;
+                const pixel_sums& p = pixels[k];
+                const double scale = 1.0 / counts[k];
+                framebuffer[k] = scale * p.color_sum;
+                aovs.albedo[k] = scale * p.albedo_sum;
+                aovs.normal[k] = p.normal_sum.near_zero() ? vec3(0,0,0) : unit_vector(p.normal_sum);
+                aovs.depth[k]  = p.depth_hits ? p.depth_sum / p.depth_hits : infinity;
+                double mean = p.lum_sum * scale;
+                aovs.variance[k] = fmax(0.0, p.lum_sq_sum * scale - mean * mean) * scale;
+            }
+            if (!covered) {
+                for (int j = 0; j < image_height; ++j) {
+                    for (int i = 0; i < image_width; ++i) {
+                        size_t k = size_t(j) * image_width + i;
+                        for (int stride = 2; counts[k] == 0 && stride <= coarsest; stride *= 2) {
+                            size_t from = size_t(j - j % stride) * image_width + (i - i % stride);
+                            if (counts[from] == 0) continue;
+                            framebuffer[k] = framebuffer[from];
+                            aovs.albedo[k] = aovs.albedo[from];
+                            aovs.normal[k] = aovs.normal[from];
+                            aovs.depth[k] = aovs.depth[from];
+                            aovs.variance[k] = aovs.variance[from];
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (denoise) {
+                atrous_denoise(framebuffer, image_width, image_height, aovs, workers(), denoiser);
+            }
+        }
+
+        using block_kernel = void (camera::*)(int, int, int, int, const hittable&, const light_list&, color*, int);
+
+        // Renders pixels [start_x, end_x) x [start_y, end_y), specialized on the frame options
+        // so the sample loop carries no checks for features that are off. Pixel (start_x, start_y)
+        // goes to out[0], rows are 'stride' apart. AOVs are always written full frame.
+        template <bool Defocus, bool MotionBlur, bool AOVs, bool Lights>
+        void render_block(int start_x, int start_y, int end_x, int end_y, const hittable& world,
+                          const light_list& lights, color* out, int stride) {
+            for (int j = start_y; j < end_y; ++j) {
+                for (int i = start_x; i < end_x; ++i) {
+                    pixel_sums sums;
+
+                    // Generate and process all rays for this pixel
+                    for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                        auto offset = sample_square();
+                        auto pixel_sample = pixel00_loc +
+                                          (i + offset.x()) * pixel_delta_u +
+                                          (j + offset.y()) * pixel_delta_v;
+
+                        auto ray_origin = Defocus ? defocus_disk_sample() : center;
+                        auto ray_direction = pixel_sample - ray_origin;
+
+                        ray r(ray_origin, ray_direction, MotionBlur ? random_double(shutter_open, shutter_close) : shutter_open);
+                        r.cone_angle = pixel_spread;
+                        if (!AOVs) {
+                            sums.color_sum += ray_color<Lights>(r, max_depth, world, lights);
+                            continue;
+                        }
+
+                        aov_sample aov;
+                        sums.add(ray_color<Lights>(r, max_depth, world, lights, 0, &aov), aov);
+                    }
+
+                    store_pixel<AOVs>(i, j, sums, out[(j - start_y) * stride + (i - start_x)]);
+                }
+            }
+        }
+
+        // Per pixel sums over its samples.
+        struct pixel_sums {
+            color  color_sum;
+            color  albedo_sum;
+            vec3   normal_sum;
+            double depth_sum = 0, lum_sum = 0, lum_sq_sum = 0;
+            int    depth_hits = 0;
+
+            void add(const color& sample_color, const aov_sample& aov) {
+                color_sum += sample_color;
+                albedo_sum += aov.albedo;
+                normal_sum += aov.normal;
+                if (!std::isinf(aov.depth)) {
+                    depth_sum += aov.depth;
+                    depth_hits++;
+                }
+                auto lum = luminance(sample_color);
+                lum_sum += lum;
+                lum_sq_sum += lum * lum;
+            }
+        };
+
+        template <bool AOVs>
+        void store_pixel(int i, int j, const pixel_sums& s, color& out) {
+            out = pixel_samples_scale * s.color_sum;
+            if (AOVs) {
+                auto pixel_index = size_t(j) * image_width + i;
+                aovs.albedo[pixel_index] = pixel_samples_scale * s.albedo_sum;
+                aovs.normal[pixel_index] = s.normal_sum.near_zero() ? vec3(0,0,0) : unit_vector(s.normal_sum);
+                aovs.depth[pixel_index]  = s.depth_hits ? s.depth_sum / s.depth_hits : infinity;
+                auto mean = s.lum_sum * pixel_samples_scale;
+                aovs.variance[pixel_index] = fmax(0.0, s.lum_sq_sum * pixel_samples_scale - mean * mean)
+                                           * pixel_samples_scale;
+            }
+        }
+
+        // Primitives of the world with their screen rectangles, binned to the render blocks.
+        struct raster_bins {
+            std::vector<const hittable*> prims;
+            std::vector<int> rects;                 // x0, y0, x1, y1 per primitive, end exclusive
+            std::vector<std::vector<int>> blocks;   // primitive indices per block
+        };
+
+        using raster_kernel = void (camera::*)(int, int, int, int, const hittable&, const light_list&,
+                                               const raster_bins&, const std::vector<int>&, color*, int);
+
+        // Pixel range whose samples can see 'box', padded by a pixel. False if it's all behind
+        // the camera; a box reaching behind the camera gets the whole screen.
+        bool screen_rect(const aabb& box, int rect[4]) const {
+            double x0 = infinity, y0 = infinity, x1 = -infinity, y1 = -infinity;
+            int behind = 0;
+            const auto du2 = pixel_delta_u.length_squared();
+            const auto dv2 = pixel_delta_v.length_squared();
+            for (int k = 0; k < 8; ++k) {
+                point3 corner((k & 1) ? box.x.max : box.x.min, (k & 2) ? box.y.max : box.y.min,
+                              (k & 4) ? box.z.max : box.z.min);
+                vec3 d = corner - center;
+                auto z = -dot(d, w);
+                if (z <= 1e-9) {
+                    behind++;
+                    continue;
+                }
+                vec3 q = center + d * (focus_dist / z) - pixel00_loc;
+                auto px = dot(q, pixel_delta_u) / du2;
+                auto py = dot(q, pixel_delta_v) / dv2;
+                x0 = fmin(x0, px); x1 = fmax(x1, px);
+                y0 = fmin(y0, py); y1 = fmax(y1, py);
+            }
+            if (behind == 8) {
+                return false;
+            }
+            if (behind > 0) {
+                rect[0] = 0; rect[1] = 0; rect[2] = image_width; rect[3] = image_height;
+                return true;
+            }
+            // pixel i takes samples in [i - 0.5, i + 0.5).
+            rect[0] = std::max(0, static_cast<int>(std::floor(fmax(-1.0, x0 + 0.5))) - 1);
+            rect[1] = std::max(0, static_cast<int>(std::floor(fmax(-1.0, y0 + 0.5))) - 1);
+            rect[2] = std::min(image_width,  static_cast<int>(std::ceil(fmin(double(image_width),  x1 + 0.5))) + 1);
+            rect[3] = std::min(image_height, static_cast<int>(std::ceil(fmin(double(image_height), y1 + 0.5))) + 1);
+            return rect[0] < rect[2] && rect[1] < rect[3];
+        }
+
+        void bin_primitives(const hittable& world, int blocks_x, int blocks_y, raster_bins& bins) {
+            world.collect_primitives(bins.prims);
+            const int count = static_cast<int>(bins.prims.size());
+            bins.rects.assign(4 * size_t(count), 0);
+            std::vector<char> visible(count, 0);
+
+            // projecting the boxes is the costly part, split it across the workers.
+            const int chunk = 1024;
+            workers().run((count + chunk - 1) / chunk, [&](int c) {
+                for (int k = c * chunk; k < std::min(count, (c + 1) * chunk); ++k) {
+                    visible[k] = screen_rect(bins.prims[k]->bounding_box(), &bins.rects[4 * k]);
+                }
+            });
+
+            bins.blocks.assign(size_t(blocks_x) * blocks_y, std::vector<int>());
+            for (int k = 0; k < count; ++k) {
+                if (!visible[k]) continue;
+                const int* r = &bins.rects[4 * k];
+                for (int by = r[1] / block_size; by <= (r[3] - 1) / block_size; ++by) {
+                    for (int bx = r[0] / block_size; bx <= (r[2] - 1) / block_size; ++bx) {
+                        bins.blocks[by * blocks_x + bx].push_back(k);
+                    }
+                }
+            }
+        }
+
+        // render_block for a pinhole camera with the first hits rasterized. One sample index at a
+        // time, every primitive binned to the block is tested exactly against the camera rays of
+        // the pixels in its rectangle, keeping the nearest (a visibility buffer of distance and
+        // primitive). Shading then starts from those hits without tracing the camera rays.
+        template <bool AOVs, bool Lights>
+        void raster_block(int start_x, int start_y, int end_x, int end_y, const hittable& world,
+                          const light_list& lights, const raster_bins& bins, const std::vector<int>& bin,
+                          color* out, int stride) {
+            const int bw = end_x - start_x;
+            const int n = bw * (end_y - start_y);
+            thread_local std::vector<pixel_sums> sums;
+            thread_local std::vector<vec3> offsets;
+            thread_local std::vector<double> depth;
+            thread_local std::vector<const hittable*> visible;
+            sums.assign(n, pixel_sums());
+            offsets.resize(n);
+            depth.resize(n);
+            visible.resize(n);
+
+            auto camera_ray = [&](int k) {
+                int i = start_x + k % bw, j = start_y + k / bw;
+                auto pixel_sample = pixel00_loc + (i + offsets[k].x()) * pixel_delta_u + (j + offsets[k].y()) * pixel_delta_v;
+                ray r(center, pixel_sample - center, shutter_open);
+                r.cone_angle = pixel_spread;
+                return r;
+            };
+
+            for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                for (int k = 0; k < n; ++k) {
+                    offsets[k] = sample_square();
+                    depth[k] = infinity;
+                    visible[k] = nullptr;
+                }
+
+                for (int index : bin) {
+                    const int* r = &bins.rects[4 * index];
+                    const hittable* prim = bins.prims[index];
+                    for (int j = std::max(r[1], start_y); j < std::min(r[3], end_y); ++j) {
+                        for (int i = std::max(r[0], start_x); i < std::min(r[2], end_x); ++i) {
+                            int k = (j - start_y) * bw + (i - start_x);
+                            double t;
+                            const hittable* hit_prim;
+                            if (prim->intersect(camera_ray(k), interval(0.0000000001, depth[k]), t, hit_prim)) {
+                                depth[k] = t;
+                                visible[k] = hit_prim;
+                            }
+                        }
+                    }
+                }
+
+                for (int k = 0; k < n; ++k) {
+                    ray r = camera_ray(k);
+                    aov_sample aov;
+                    color c;
+                    if (visible[k]) {
+                        hit_record rec;
+                        visible[k]->fill_hit_record(r, depth[k], rec);
+                        c = shade_hit<Lights>(r, rec, max_depth, world, lights, 0, AOVs ? &aov : nullptr, vec3(0,0,0), false);
+                    } else {
+                        c = shade_miss<Lights>(r, lights, 0, AOVs ? &aov : nullptr);
+                    }
+                    if (AOVs) {
+                        sums[k].add(c, aov);
+                    } else {
+                        sums[k].color_sum += c;
+                    }
+                }
+            }
+
+            for (int k = 0; k < n; ++k) {
+                int i = start_x + k % bw, j = start_y + k / bw;
+                store_pixel<AOVs>(i, j, sums[k], out[(j - start_y) * stride + (i - start_x)]);
+            }
+        }
+
+        // Turns runtime flags into template arguments one at a time:
+        // pick_kernel(a, b, c, d) returns &camera::render_block<a, b, c, d>.
+        template <bool... Flags>
+        static block_kernel pick_kernel() {
+            return &camera::render_block<Flags...>;
+        }
+
+        template <bool... Flags, class... Rest>
+        static block_kernel pick_kernel(bool flag, Rest... rest) {
+            return flag ? pick_kernel<Flags..., true>(rest...) : pick_kernel<Flags..., false>(rest...);
+        }
+
+        color ray_color (const ray& r, int depth, const hittable& world, const light_list& lights) const {
+            return lights.empty() ? ray_color<false>(r, depth, world, lights) : ray_color<true>(r, depth, world, lights);
+        }
+
+        // Lights is false when the light list is empty, which drops light sampling and MIS.
+        template <bool Lights>
+        color ray_color (const ray& r, int depth, const hittable& world, const light_list& lights,
+                         double scatter_pdf = 0, aov_sample* aov = nullptr,
+                         const vec3& from_normal = vec3(0,0,0), bool after_diffuse = false) const {
+            // scatter_pdf is the solid angle pdf of the diffuse bounce that produced 'r',
+            // 0 for camera rays and specular bounces (those see emitters at full weight).
+            // from_normal is the surface normal at that bounce, for light selection.
+            // after_diffuse is set once the path has had a diffuse vertex.
+            // aov, when given, receives the features of this (first) hit.
             hit_record rec;
 
             if (depth == 0) {
@@ -227,18 +849,108 @@ class camera {
             }
 
             if (world.hit(r, interval(0.0000000001, infinity), rec)) {
-                ray scattered;
-                color attenuation;
-                if (rec.mat->scatter(r, rec, attenuation, scattered)) {
-                    return attenuation * ray_color(scattered, depth -1, world);
-                } else {
-                    return color(0, 0, 0);
+                return shade_hit<Lights>(r, rec, depth, world, lights, scatter_pdf, aov, from_normal, after_diffuse);
+            }
+            return shade_miss<Lights>(r, lights, scatter_pdf, aov);
+        }
+
+        // Radiance leaving the hit 'rec' back along 'r', arguments as for ray_color().
+        template <bool Lights>
+        color shade_hit(const ray& r, const hit_record& rec, int depth, const hittable& world,
+                        const light_list& lights, double scatter_pdf, aov_sample* aov,
+                        const vec3& from_normal, bool after_diffuse) const {
+            if (aov) {
+                aov->albedo = rec.mat->albedo_aov(r, rec);
+                aov->normal = rec.normal;
+                aov->depth  = rec.t * r.direction().length();
+            }
+
+            color emitted = rec.mat->emitted(r, rec);
+            if (Lights && scatter_pdf > 0) {
+                // this emitter was also reachable through light sampling at the previous hit.
+                auto light_pdf = lights.pdf_value(r.origin(), from_normal, rec.p);
+                emitted = power_heuristic(scatter_pdf, light_pdf) * emitted;
+            }
+            if (Lights && caustics && after_diffuse && scatter_pdf == 0 && !emitted.near_zero()
+                && caustics->carries(lights.find(rec.p))) {
+                // a D S+ L path to a light the caustic photon map already carries.
+                emitted = color(0,0,0);
+            }
+
+            // deep enough diffuse hits end the path in the cache once it knows the spot.
+            const bool cacheable = cache && rec.mat->is_diffuse();
+            color cached;
+            if (cacheable && max_depth - depth >= cache_bounce && cache->lookup(rec.p, rec.normal, cached)) {
+                return emitted + cached;
+            }
+
+            ray scattered;
+            color attenuation;
+            if (rec.mat->scatter(r, rec, attenuation, scattered)) {
+                auto pdf = rec.mat->scattering_pdf(r, rec, scattered.direction());
+                const bool diffuse = rec.mat->is_diffuse();
+                // the cone carries on from its width here; a diffuse bounce spreads it out.
+                scattered.cone_width = r.footprint(rec.t);
+                scattered.cone_angle = diffuse ? std::fmax(r.cone_angle, diffuse_spread) : r.cone_angle;
+                color direct = (Lights && pdf > 0) ? sample_direct(r, rec, world, lights) : color(0,0,0);
+                color reflected = direct
+                                + attenuation * ray_color<Lights>(scattered, depth -1, world, lights, pdf, nullptr,
+                                                                  rec.normal, after_diffuse || diffuse);
+                if (Lights && caustics && diffuse) {
+                    reflected += caustics->gather(r, rec, caustic_k, caustic_radius);
+                }
+                if (cacheable) {
+                    cache->add(rec.p, rec.normal, reflected);
+                }
+                return emitted + reflected;
+            } else {
+                return emitted;
+            }
+        }
+
+        // Radiance arriving along 'r' from the background.
+        template <bool Lights>
+        color shade_miss(const ray& r, const light_list& lights, double scatter_pdf, aov_sample* aov) const {
+            if (Lights && lights.has_background()) {
+                color env = lights.background(r.direction());
+                if (aov) {
+                    aov->albedo = env;
                 }
+                if (scatter_pdf > 0) {
+                    env = power_heuristic(scatter_pdf, lights.pdf_background(r.direction())) * env;
+                }
+                return env;
             }
 
             vec3 unit_direction = unit_vector(r.direction());
             auto a = 0.5 * (unit_direction.y() + 1.0);
-            return (1.0-a)*color(1.0, 1.0, 1.0) + a*color(0.5, 0.7, 1.0);
+            color sky = (1.0-a)*color(1.0, 1.0, 1.0) + a*color(0.5, 0.7, 1.0);
+            if (aov) {
+                aov->albedo = sky;
+            }
+            return sky;
+        }
+
+        color sample_direct(const ray& r, const hit_record& rec, const hittable& world,
+                            const light_list& lights) const {
+            // Next-event estimation: one shadow ray towards a sampled light, MIS weighted
+            // against the BSDF sampling done by ray_color().
+            light_sample ls;
+            if (!lights.sample(rec.p, rec.normal, ls) || ls.pdf <= 0) {
+                return color(0,0,0);
+            }
+
+            color f = rec.mat->eval(r, rec, ls.wi);
+            if (f.near_zero()) {
+                return color(0,0,0);
+            }
+
+            if (world.occluded(ray(rec.p, ls.wi, r.time()), interval(0.001, ls.dist * (1 - 1e-6) - 0.001))) {
+                return color(0,0,0);
+            }
+
+            auto weight = ls.delta ? 1.0 : power_heuristic(ls.pdf, rec.mat->scattering_pdf(r, rec, ls.wi));
+            return (weight / ls.pdf) * f * ls.Li;
         }
 
         void get_pixel_rays(int i, int j, std::vector<ray>& rays) const {
@@ -251,7 +963,8 @@ class camera {
                 auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
                 auto ray_direction = pixel_sample - ray_origin;
 
-                rays[sample] = ray(ray_origin, ray_direction);
+                rays[sample] = ray(ray_origin, ray_direction, sample_time());
+                rays[sample].cone_angle = pixel_spread;
             }
         }
 
@@ -267,7 +980,13 @@ class camera {
             auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
             auto ray_direction = pixel_sample - ray_origin;
 
-            return ray(ray_origin, ray_direction);
+            ray r(ray_origin, ray_direction, sample_time());
+            r.cone_angle = pixel_spread;
+            return r;
+        }
+
+        double sample_time() const {
+            return (shutter_close > shutter_open) ? random_double(shutter_open, shutter_close) : shutter_open;
         }
 
         point3 defocus_disk_sample() const {
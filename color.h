@@ -13,12 +13,21 @@ inline double liniar_to_gamma(double linear_component) {
     return 0;
 }
 
+inline double luminance(const color& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// Gamma-encoded [0, 255] value of one linear channel.
+inline int quantize_channel(double linear_component) {
+    static const interval intensity(0.000, 0.999);
+    return static_cast<int>(256 * intensity.clamp(liniar_to_gamma(linear_component)));
+}
+
 void write_color(std::ostream &out, color pixel_color) {
     // writes the transalted [0, 255] value of each color.
-    static const interval intensity(0.000, 0.999);
-    out << static_cast<int>(256 * intensity.clamp(liniar_to_gamma(pixel_color.x()))) << ' '
-        << static_cast<int>(256 * intensity.clamp(liniar_to_gamma(pixel_color.y()))) << ' '
-        << static_cast<int>(256 * intensity.clamp(liniar_to_gamma(pixel_color.z()))) << '\n';
+    out << quantize_channel(pixel_color.x()) << ' '
+        << quantize_channel(pixel_color.y()) << ' '
+        << quantize_channel(pixel_color.z()) << '\n';
 }
 
 #endif
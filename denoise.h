@@ -0,0 +1,125 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "mlem.h"
+#include "color.h"
+#include "numa.h"
+#include "thread_pool.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Features of one camera ray's first hit.
+struct aov_sample {
+    color  albedo;
+    vec3   normal;
+    double depth = infinity;
+};
+
+// First-hit feature buffers (AOVs) the camera can write next to the color framebuffer.
+struct aov_buffers {
+    std::vector<color>  albedo;    // material albedo at the first hit, sky color on a miss
+    std::vector<vec3>   normal;    // shading normal at the first hit, zero on a miss
+    std::vector<double> depth;     // distance to the first hit, infinity on a miss
+    std::vector<double> variance;  // variance of the pixel mean luminance
+
+    void resize(size_t n) {
+        albedo.assign(n, color(0,0,0));
+        normal.assign(n, vec3(0,0,0));
+        depth.assign(n, infinity);
+        variance.assign(n, 0);
+    }
+
+    bool empty() const { return albedo.empty(); }
+};
+
+struct denoise_settings {
+    int    iterations   = 5;     // a-trous passes, the footprint doubles each time
+    double sigma_color  = 4.0;   // luminance edge stop, in standard deviations
+    double sigma_normal = 128;   // exponent on the normal cosine
+    double sigma_depth  = 0.1;   // relative depth difference tolerated per step
+};
+
+// Edge-aware a-trous wavelet filter guided by the feature buffers (SVGF style).
+// Color is divided by albedo first so textures and material edges survive, only the
+// illumination gets filtered, then the albedo is multiplied back in.
+void atrous_denoise(color_buffer& image, int width, int height, const aov_buffers& aovs,
+                    thread_pool& pool, const denoise_settings& settings = denoise_settings()) {
+    static const double kernel[3] = { 3.0/8.0, 1.0/4.0, 1.0/16.0 };
+    const double eps = 1e-4;
+    const size_t n = image.size();
+
+    std::vector<color>  illum(n), illum_next(n);
+    std::vector<double> var(aovs.variance), var_next(n);
+
+    for (size_t k = 0; k < n; ++k) {
+        const color& a = aovs.albedo[k];
+        illum[k] = color(image[k].x() / (a.x() + eps), image[k].y() / (a.y() + eps), image[k].z() / (a.z() + eps));
+        auto l = luminance(a) + eps;
+        var[k] /= l * l;
+    }
+
+    const int rows_per_task = 8;
+    const int tasks = (height + rows_per_task - 1) / rows_per_task;
+
+    for (int it = 0; it < settings.iterations; ++it) {
+        const int step = 1 << it;
+
+        pool.run(tasks, [&](int task) {
+            int end_y = std::min(height, (task + 1) * rows_per_task);
+            for (int y = task * rows_per_task; y < end_y; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    const size_t p = size_t(y) * width + x;
+                    const double lum_p = luminance(illum[p]);
+                    const double sigma_l = settings.sigma_color * sqrt(fmax(var[p], 0.0)) + eps;
+                    const bool   miss_p = std::isinf(aovs.depth[p]);
+
+                    color  sum(0,0,0);
+                    double sum_w = 0, sum_var = 0;
+
+                    for (int dy = -2; dy <= 2; ++dy) {
+                        int qy = y + dy * step;
+                        if (qy < 0 || qy >= height) continue;
+                        for (int dx = -2; dx <= 2; ++dx) {
+                            int qx = x + dx * step;
+                            if (qx < 0 || qx >= width) continue;
+                            const size_t q = size_t(qy) * width + qx;
+
+                            double w = kernel[abs(dx)] * kernel[abs(dy)];
+                            if (q != p) {
+                                const bool miss_q = std::isinf(aovs.depth[q]);
+                                if (miss_p != miss_q) continue;
+                                if (!miss_p) {
+                                    auto zp = aovs.depth[p], zq = aovs.depth[q];
+                                    auto w_z = exp(-fabs(zp - zq) / (settings.sigma_depth * step * zp + eps));
+                                    auto w_n = pow(fmax(0.0, dot(aovs.normal[p], aovs.normal[q])), settings.sigma_normal);
+                                    w *= w_z * w_n;
+                                }
+                                w *= exp(-fabs(lum_p - luminance(illum[q])) / sigma_l);
+                            }
+
+                            sum += w * illum[q];
+                            sum_w += w;
+                            sum_var += w * w * var[q];
+                        }
+                    }
+
+                    illum_next[p] = sum / sum_w;
+                    var_next[p] = sum_var / (sum_w * sum_w);
+                }
+            }
+        });
+
+        illum.swap(illum_next);
+        var.swap(var_next);
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        const color& a = aovs.albedo[k];
+        image[k] = color(illum[k].x() * (a.x() + eps), illum[k].y() * (a.y() + eps), illum[k].z() * (a.z() + eps));
+    }
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "alias_table.h"
+#include "light.h"
+#include "pfm.h"
+
+#include <string>
+#include <vector>
+
+// Equirectangular HDR environment, +y up. Importance sampled from the pixels:
+// a marginal alias table picks the row, that row's conditional table picks the column,
+// with weights luminance * sin(theta) so the pdf is proportional to the radiance per
+// solid angle. Everything is built once in the constructor and read-only afterwards,
+// so one instance can be shared by all render threads.
+class environment_light : public light {
+    private:
+        int width, height;
+        std::vector<float> rgb; // top row first, 3 floats per pixel
+        alias_table rows;
+        std::vector<alias_table> columns;
+
+        color texel(int i, int j) const {
+            const float* p = &rgb[3 * (size_t(j) * width + i)];
+            return color(p[0], p[1], p[2]);
+        }
+
+        void to_pixel(const vec3& dir, int& i, int& j, double& sin_theta) const {
+            vec3 d = unit_vector(dir);
+            auto cos_theta = fmin(1.0, fmax(-1.0, d.y()));
+            sin_theta = sqrt(fmax(0.0, 1 - cos_theta * cos_theta));
+            auto u = (atan2(d.z(), d.x()) + M_PI) / (2 * M_PI);
+            auto v = acos(cos_theta) / M_PI;
+            i = std::min(width - 1, std::max(0, static_cast<int>(u * width)));
+            j = std::min(height - 1, std::max(0, static_cast<int>(v * height)));
+        }
+
+        double pixel_pdf(int i, int j, double sin_theta) const {
+            if (sin_theta <= 0) return 0;
+            // probability of the pixel spread over its solid angle.
+            auto p = rows.probability(j) * columns[j].probability(i);
+            return p * width * height / (2 * M_PI * M_PI * sin_theta);
+        }
+
+    public:
+        environment_light(int w, int h, const std::vector<color>& pixels, double scale = 1)
+          : width(w), height(h), rgb(3 * size_t(w) * h), columns(h)
+        {
+            std::vector<double> row_weight(h), weight(w);
+            for (int j = 0; j < h; ++j) {
+                auto sin_theta = sin(M_PI * (j + 0.5) / h);
+                double sum = 0;
+                for (int i = 0; i < w; ++i) {
+                    color c = scale * pixels[size_t(j) * w + i];
+                    for (int k = 0; k < 3; ++k) {
+                        rgb[3 * (size_t(j) * w + i) + k] = static_cast<float>(c[k]);
+                    }
+                    weight[i] = luminance(c) * sin_theta;
+                    sum += weight[i];
+                }
+                columns[j] = alias_table(weight);
+                row_weight[j] = sum;
+            }
+            rows = alias_table(row_weight);
+        }
+
+        // Returns nullptr if 'path' isn't a readable RGB PFM.
+        static shared_ptr<environment_light> load(const std::string& path, double scale = 1) {
+            int w, h;
+            std::vector<color> pixels;
+            if (!read_pfm(path, w, h, pixels)) {
+                return nullptr;
+            }
+            return make_shared<environment_light>(w, h, pixels, scale);
+        }
+
+        bool is_infinite() const override { return true; }
+
+        color Le(const vec3& dir) const override {
+            int i, j;
+            double sin_theta;
+            to_pixel(dir, i, j, sin_theta);
+            return texel(i, j);
+        }
+
+        bool sample(const point3& p, light_sample& ls) const override {
+            double fu, fv;
+            auto j = rows.sample(random_double(), &fv);
+            auto i = columns[j].sample(random_double(), &fu);
+
+            auto theta = M_PI * (j + fv) / height;
+            auto phi = 2 * M_PI * (i + fu) / width - M_PI;
+            auto sin_theta = sin(theta);
+
+            ls.wi = vec3(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+            ls.dist = infinity;
+            ls.pdf = pixel_pdf(int(i), int(j), sin_theta);
+            ls.Li = texel(int(i), int(j));
+            ls.delta = false;
+            return ls.pdf > 0;
+        }
+
+        double pdf_value(const point3& origin, const point3& on_light) const override {
+            return 0; // never hit as geometry, see pdf_direction().
+        }
+
+        double pdf_direction(const vec3& dir) const override {
+            int i, j;
+            double sin_theta;
+            to_pixel(dir, i, j, sin_theta);
+            return pixel_pdf(i, j, sin_theta);
+        }
+};
+
+#endif
@@ -1,11 +1,15 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
 #include "interval.h"
 #include "mlem.h"
 #include "vec3.h"
 #include "ray.h"
 
+#include <cassert>
+#include <vector>
+
 class material;
 
 class hit_record {
@@ -15,6 +19,8 @@ class hit_record {
         double t;
         shared_ptr<material> mat;
         bool front_face;
+        double u = 0, v = 0;       // surface coordinates for textures
+        double uv_per_unit = 0;    // uv change per unit of surface distance, for mip selection
 
         void set_face_normal(const ray& r, const vec3& outward_normal) {
             // sets the hit record normal vector.
@@ -29,6 +35,50 @@ class hittable {
         virtual ~hittable() = default;
 
         virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+        // Bounds over the whole [0,1] time range, so moving objects are covered at any shutter time.
+        virtual aabb bounding_box() const = 0;
+
+        virtual bool is_moving() const { return false; }
+
+        virtual bool occluded(const ray& r, interval ray_t) const {
+            // any-hit query for shadow rays: true if anything blocks the ray inside ray_t.
+            // the default falls back to the closest-hit search, primitives should override it.
+            hit_record rec;
+            return hit(r, ray_t, rec);
+        }
+
+        // Closest-hit search that only records the distance and the primitive that was hit.
+        // Aggregates call this while they search and build the full hit_record once, for the
+        // final closest hit, through prim->fill_hit_record().
+        virtual bool intersect(const ray& r, interval ray_t, double& t, const hittable*& prim) const {
+            hit_record rec;
+            if (!hit(r, ray_t, rec)) {
+                return false;
+            }
+            t = rec.t;
+            prim = this;
+            return true;
+        }
+
+        // Appends the leaf primitives under this object, just itself for a primitive.
+        // Passes that work on primitives directly (the raster pre-pass) start from here.
+        virtual void collect_primitives(std::vector<const hittable*>& out) const {
+            out.push_back(this);
+        }
+
+        // Surface attributes for a hit at distance t found by intersect().
+        virtual void fill_hit_record(const ray& r, double t, hit_record& rec) const {
+            // the default re-runs the full hit test in a narrow window around t. Should rounding
+            // put the root outside it, the search goes on from a little before t, which finds
+            // it again as it was the closest hit.
+            auto tolerance = 1e-9 * fmax(1.0, fabs(t));
+            if (!hit(r, interval(t - tolerance, t + tolerance), rec)) {
+                bool found = hit(r, interval(t - 1000 * tolerance, infinity), rec);
+                assert(found && "fill_hit_record() without a hit at t");
+                (void)found;
+            }
+        }
 };
 
 #endif
@@ -20,28 +20,72 @@ class hittable_list : public hittable {
 
         void clear() {
             objects.clear();
+            bbox = aabb();
         }
 
         void add(shared_ptr<hittable> object) {
             objects.push_back(object);
+            bbox = aabb(bbox, object->bounding_box());
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override;
+        bool occluded(const ray& r, interval ray_t) const override;
+        bool intersect(const ray& r, interval ray_t, double& t, const hittable*& prim) const override;
 
+        aabb bounding_box() const override { return bbox; }
+
+        void collect_primitives(std::vector<const hittable*>& out) const override {
+            for (const auto& object : objects) {
+                object->collect_primitives(out);
+            }
+        }
+
+        bool is_moving() const override {
+            for (const auto& object : objects) {
+                if (object->is_moving()) return true;
+            }
+            return false;
+        }
+
+    private:
+        aabb bbox;
 
 };
 
 bool hittable_list::hit(const ray& r, interval ray_t, hit_record& rec) const{
+    double t;
+    const hittable* prim;
+    if (!intersect(r, ray_t, t, prim)) {
+        return false;
+    }
+    // surface attributes only for the closest hit.
+    prim->fill_hit_record(r, t, rec);
+    return true;
+}
+
+bool hittable_list::intersect(const ray& r, interval ray_t, double& t, const hittable*& prim) const {
     bool hit_anything = false;
     auto closest_so_far = ray_t.max;
 
     for (const auto& object : objects) {
-        if (object->hit(r, interval(ray_t.min, closest_so_far), rec)) {
+        if (object->intersect(r, interval(ray_t.min, closest_so_far), closest_so_far, prim)) {
             hit_anything = true; 
-            closest_so_far = rec.t;
         }
     }
+    if (hit_anything) {
+        t = closest_so_far;
+    }
     return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, interval ray_t) const {
+    // stops at the first blocker, no need to keep searching for the closest one.
+    for (const auto& object : objects) {
+        if (object->occluded(r, ray_t)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 #endif
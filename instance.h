@@ -0,0 +1,97 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "mlem.h"
+#include "ray.h"
+#include "vec3.h"
+
+#include <cassert>
+#include <vector>
+
+// Places a shared object in the world with a translation that can change over time.
+// One offset is a static instance, more are keyframes spread evenly over [0,1].
+class moving_instance : public hittable {
+    private:
+        shared_ptr<hittable> object;
+        std::vector<vec3> offsets;
+        aabb bbox;
+
+        vec3 offset_at(double time) const {
+            if (offsets.size() == 1) {
+                return offsets[0];
+            }
+            auto x = interval(0, 1).clamp(time) * (offsets.size() - 1);
+            auto k = std::min(static_cast<size_t>(x), offsets.size() - 2);
+            auto f = x - k;
+            return (1 - f) * offsets[k] + f * offsets[k+1];
+        }
+
+    public:
+        moving_instance(shared_ptr<hittable> p, const vec3& offset)
+            : moving_instance(p, std::vector<vec3>{offset}) {}
+
+        moving_instance(shared_ptr<hittable> p, const vec3& offset0, const vec3& offset1)
+            : moving_instance(p, std::vector<vec3>{offset0, offset1}) {}
+
+        moving_instance(shared_ptr<hittable> p, const std::vector<vec3>& keys) : object(p), offsets(keys) {
+            // a linear sweep of a box stays inside the union of the boxes at its ends.
+            for (const auto& offset : offsets) {
+                bbox = aabb(bbox, object->bounding_box().translated(offset));
+            }
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            // move the ray into object space instead of moving the object.
+            auto offset = offset_at(r.time());
+            ray offset_r(r.origin() - offset, r.direction(), r.time());
+
+            if (!object->hit(offset_r, ray_t, rec)) {
+                return false;
+            }
+
+            rec.p += offset;
+            return true;
+        }
+
+        bool intersect(const ray& r, interval ray_t, double& t, const hittable*& prim) const override {
+            ray offset_r(r.origin() - offset_at(r.time()), r.direction(), r.time());
+            const hittable* inner;
+            if (!object->intersect(offset_r, ray_t, t, inner)) {
+                return false;
+            }
+            // the instance finishes the hit itself, it has to move the ray first.
+            prim = this;
+            return true;
+        }
+
+        void fill_hit_record(const ray& r, double t, hit_record& rec) const override {
+            auto offset = offset_at(r.time());
+            ray offset_r(r.origin() - offset, r.direction(), r.time());
+
+            const hittable* inner;
+            double inner_t;
+            auto tolerance = 1e-9 * fmax(1.0, fabs(t));
+            if (object->intersect(offset_r, interval(t - tolerance, t + tolerance), inner_t, inner)) {
+                inner->fill_hit_record(offset_r, inner_t, rec);
+            } else {
+                // rounding put the root outside the window, search on from a little before t
+                // (t was the closest hit, so this finds it again).
+                bool found = object->hit(offset_r, interval(t - 1000 * tolerance, infinity), rec);
+                assert(found && "fill_hit_record() without a hit at t");
+                (void)found;
+            }
+            rec.p += offset;
+        }
+
+        bool occluded(const ray& r, interval ray_t) const override {
+            ray offset_r(r.origin() - offset_at(r.time()), r.direction(), r.time());
+            return object->occluded(offset_r, ray_t);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        bool is_moving() const override { return offsets.size() > 1 || object->is_moving(); }
+};
+
+#endif
@@ -9,6 +9,17 @@ class interval {
 
         interval() : min(+infinity), max(-infinity) {}
         interval(double _min, double _max) : min(_min), max(_max) {}
+        interval(const interval& a, const interval& b)
+            : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
+
+        double size() const {
+            return max - min;
+        }
+
+        interval expand(double delta) const {
+            auto padding = delta / 2;
+            return interval(min - padding, max + padding);
+        }
 
         bool contains(double x) const {
             return min <= x && x <= max;
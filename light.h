@@ -0,0 +1,542 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "mlem.h"
+#include "aabb.h"
+#include "color.h"
+#include "onb.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Result of sampling a light from a shading point.
+struct light_sample {
+    vec3   wi;          // unit direction from the shading point towards the light
+    double dist = 0;    // distance to the sampled point on the light
+    double pdf  = 0;    // solid angle pdf (1 for delta lights)
+    color  Li;          // incoming radiance along wi
+    bool   delta = false;
+};
+
+// cos(max(0, a - b)) from the sines and cosines of a and b.
+inline double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+    if (cos_a > cos_b) return 1;
+    return cos_a * cos_b + sin_a * sin_b;
+}
+
+// Conservative summary of a group of emitters for the light BVH: where they are, how much
+// power they emit and in which directions. Normals lie within theta_o of w, and emission
+// falls off to nothing theta_e beyond that.
+struct light_bounds {
+    aabb   box;
+    double phi = 0;
+    vec3   w = vec3(0, 0, 1);
+    double cos_theta_o = -1;  // -1: normals in every direction
+    double cos_theta_e = 0;   // cos(pi/2), emission over the hemisphere around a normal
+
+    light_bounds() {}
+
+    light_bounds(const aabb& b, double power, const vec3& axis, double cos_o, double cos_e)
+      : box(b), phi(power), w(unit_vector(axis)), cos_theta_o(cos_o), cos_theta_e(cos_e) {}
+
+    light_bounds(const light_bounds& a, const light_bounds& b) {
+        if (a.phi <= 0) { *this = b; return; }
+        if (b.phi <= 0) { *this = a; return; }
+        box = aabb(a.box, b.box);
+        phi = a.phi + b.phi;
+        cos_theta_e = fmin(a.cos_theta_e, b.cos_theta_e);
+        merge_cones(a, b);
+    }
+
+    // Estimated contribution at p with surface normal n (n = 0 for no normal).
+    double importance(const point3& p, const vec3& n) const {
+        point3 pc = box.centroid();
+        vec3 diag(box.x.size(), box.y.size(), box.z.size());
+        auto radius2 = 0.25 * diag.length_squared();
+        auto d2 = fmax((p - pc).length_squared(), 0.5 * diag.length());
+
+        // angle subtended by the bounding sphere.
+        auto dist2 = (p - pc).length_squared();
+        double cos_b = -1, sin_b = 0;
+        if (dist2 > radius2) {
+            auto sin2 = radius2 / dist2;
+            cos_b = sqrt(1 - sin2);
+            sin_b = sqrt(sin2);
+        }
+
+        vec3 wi = dist2 > 0 ? (p - pc) / sqrt(dist2) : vec3(0, 0, 1);
+        auto cos_w = dot(w, wi);
+        auto sin_w = sqrt(fmax(0.0, 1 - cos_w * cos_w));
+        auto sin_o = sqrt(fmax(0.0, 1 - cos_theta_o * cos_theta_o));
+
+        auto cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, cos_theta_o);
+        auto sin_x = sqrt(fmax(0.0, 1 - cos_x * cos_x));
+        auto cos_p = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+        if (cos_p <= cos_theta_e) {
+            return 0;
+        }
+
+        auto result = phi * cos_p / d2;
+        if (n.length_squared() > 0) {
+            auto cos_i = fabs(dot(wi, n));
+            auto sin_i = sqrt(fmax(0.0, 1 - cos_i * cos_i));
+            result *= cos_sub_clamped(sin_i, cos_i, sin_b, cos_b);
+        }
+        return fmax(0.0, result);
+    }
+
+    private:
+        void merge_cones(const light_bounds& a, const light_bounds& b) {
+            auto theta_a = acos(fmax(-1.0, fmin(1.0, a.cos_theta_o)));
+            auto theta_b = acos(fmax(-1.0, fmin(1.0, b.cos_theta_o)));
+            auto theta_d = acos(fmax(-1.0, fmin(1.0, dot(a.w, b.w))));
+
+            if (fmin(theta_d + theta_b, M_PI) <= theta_a) { w = a.w; cos_theta_o = a.cos_theta_o; return; }
+            if (fmin(theta_d + theta_a, M_PI) <= theta_b) { w = b.w; cos_theta_o = b.cos_theta_o; return; }
+
+            auto theta_o = 0.5 * (theta_a + theta_d + theta_b);
+            vec3 axis = cross(a.w, b.w);
+            if (theta_o >= M_PI || axis.length_squared() == 0) {
+                w = a.w;
+                cos_theta_o = -1;
+                return;
+            }
+
+            // rotate a.w towards b.w by theta_o - theta_a.
+            auto theta_r = theta_o - theta_a;
+            axis = unit_vector(axis);
+            w = cos(theta_r) * a.w + sin(theta_r) * cross(axis, a.w) + (1 - cos(theta_r)) * dot(axis, a.w) * axis;
+            cos_theta_o = cos(theta_o);
+        }
+};
+
+inline double power_heuristic(double pdf_a, double pdf_b) {
+    auto a2 = pdf_a * pdf_a;
+    auto b2 = pdf_b * pdf_b;
+    return (a2 + b2) > 0 ? a2 / (a2 + b2) : 0;
+}
+
+class light {
+    public:
+        virtual ~light() = default;
+
+        virtual bool sample(const point3& p, light_sample& ls) const = 0;
+
+        // Solid angle pdf that sample() would return for the point 'on_light' seen from 'origin'.
+        // Returns 0 if 'on_light' isn't on this light.
+        virtual double pdf_value(const point3& origin, const point3& on_light) const = 0;
+
+        // Lights at infinity (environments) are seen by rays that miss the world instead.
+        virtual bool is_infinite() const { return false; }
+        virtual color Le(const vec3& dir) const { return color(0,0,0); }
+        virtual double pdf_direction(const vec3& dir) const { return 0; }
+
+        // Starts a photon: a ray leaving the light and the flux it carries if it were the
+        // only photon (divide by the photon count). False for lights that can't emit photons.
+        virtual bool sample_emission(ray& r, color& flux) const { return false; }
+
+        // True if p is on the light's surface, to match hits on emissive geometry to it.
+        virtual bool on_light(const point3& p) const { return false; }
+
+        // Finite lights describe themselves for the light BVH.
+        virtual light_bounds bounds() const { return light_bounds(); }
+};
+
+class point_light : public light {
+    private:
+        point3 position;
+        color  intensity;
+
+    public:
+        point_light(const point3& pos, const color& i) : position(pos), intensity(i) {}
+
+        bool sample(const point3& p, light_sample& ls) const override {
+            vec3 d = position - p;
+            auto dist2 = d.length_squared();
+            if (dist2 <= 0) {
+                return false;
+            }
+            ls.dist = sqrt(dist2);
+            ls.wi = d / ls.dist;
+            ls.pdf = 1;
+            ls.Li = intensity / dist2;
+            ls.delta = true;
+            return true;
+        }
+
+        double pdf_value(const point3& origin, const point3& on_light) const override {
+            return 0; // can't be hit by a scattered ray.
+        }
+
+        bool sample_emission(ray& r, color& flux) const override {
+            r = ray(position, random_unit_vector());
+            flux = 4 * M_PI * intensity;
+            return true;
+        }
+
+        light_bounds bounds() const override {
+            return light_bounds(aabb(position, position), 4 * M_PI * luminance(intensity), vec3(0,0,1), -1, 0);
+        }
+};
+
+// Spherical area light, sampled uniformly over the cone it subtends.
+// The matching geometry (a sphere with a diffuse_light material) lives in the world.
+class sphere_light : public light {
+    private:
+        point3 center;
+        double radius;
+        color  emit;
+
+        double cone_cos_max(const point3& p) const {
+            auto dist2 = (center - p).length_squared();
+            if (dist2 <= radius * radius) {
+                return -2; // inside the light, no cone.
+            }
+            return sqrt(1 - radius * radius / dist2);
+        }
+
+    public:
+        sphere_light(const point3& cen, double r, const color& e) : center(cen), radius(r), emit(e) {}
+
+        bool sample(const point3& p, light_sample& ls) const override {
+            auto cos_max = cone_cos_max(p);
+            if (cos_max < -1) {
+                return false;
+            }
+
+            auto r1 = random_double();
+            auto r2 = random_double();
+            auto cos_theta = 1 + r1 * (cos_max - 1);
+            auto sin_theta = sqrt(fmax(0.0, 1 - cos_theta * cos_theta));
+            auto phi = 2 * M_PI * r2;
+
+            onb uvw(center - p);
+            ls.wi = uvw.transform(vec3(cos(phi) * sin_theta, sin(phi) * sin_theta, cos_theta));
+
+            // distance to the near side of the sphere along wi.
+            vec3 oc = p - center;
+            auto half_b = dot(oc, ls.wi);
+            auto c = dot(oc, oc) - radius * radius;
+            ls.dist = -half_b - sqrt(fmax(0.0, half_b * half_b - c));
+
+            ls.pdf = 1 / (2 * M_PI * (1 - cos_max));
+            ls.Li = emit;
+            ls.delta = false;
+            return true;
+        }
+
+        double pdf_value(const point3& origin, const point3& on_light) const override {
+            auto cos_max = cone_cos_max(origin);
+            if (cos_max < -1) {
+                return 0;
+            }
+            // the hit has to be on this sphere, not on another emitter in the same direction.
+            if (!this->on_light(on_light)) {
+                return 0;
+            }
+            return 1 / (2 * M_PI * (1 - cos_max));
+        }
+
+        bool on_light(const point3& p) const override {
+            return fabs((p - center).length() - radius) <= 1e-4 * radius;
+        }
+
+        bool sample_emission(ray& r, color& flux) const override {
+            // uniform point on the sphere, cosine weighted direction around its normal.
+            vec3 n = random_unit_vector();
+            onb uvw(n);
+            r = ray(center + radius * n, uvw.transform(sample_cosine_hemisphere(random_double(), random_double())));
+            flux = M_PI * 4 * M_PI * radius * radius * emit;
+            return true;
+        }
+
+        light_bounds bounds() const override {
+            vec3 rvec(radius, radius, radius);
+            auto power = M_PI * 4 * M_PI * radius * radius * luminance(emit);
+            return light_bounds(aabb(center - rvec, center + rvec), power, vec3(0,0,1), -1, 0);
+        }
+};
+
+// Light hierarchy over finite emitters. Sampling walks down from the root choosing each
+// child in proportion to its light_bounds::importance() at the shading point, so one
+// sample costs O(log n) however many lights there are. pdf() retraces the same choices
+// along the nodes whose boxes contain the point that was hit on a light.
+class light_bvh {
+    public:
+        light_bvh(const std::vector<shared_ptr<light>>& lights) {
+            std::vector<int> order;
+            for (const auto& l : lights) {
+                if (l->is_infinite()) continue;
+                auto b = l->bounds();
+                if (b.phi <= 0) continue;
+                order.push_back(static_cast<int>(leaves.size()));
+                leaves.push_back(l.get());
+                leaf_bounds.push_back(b);
+            }
+            if (!order.empty()) {
+                nodes.reserve(2 * order.size());
+                build(order, 0, order.size());
+            }
+        }
+
+        bool empty() const { return nodes.empty(); }
+
+        bool sample(const point3& p, const vec3& n, light_sample& ls) const {
+            if (nodes.empty()) {
+                return false;
+            }
+            int index = 0;
+            double pmf = 1;
+            while (nodes[index].light < 0) {
+                const node& a = nodes[nodes[index].child[0]];
+                const node& b = nodes[nodes[index].child[1]];
+                auto ia = a.bounds.importance(p, n);
+                auto ib = b.bounds.importance(p, n);
+                if (ia + ib <= 0) {
+                    return false;
+                }
+                auto pa = ia / (ia + ib);
+                if (random_double() < pa) {
+                    index = nodes[index].child[0];
+                    pmf *= pa;
+                } else {
+                    index = nodes[index].child[1];
+                    pmf *= 1 - pa;
+                }
+            }
+            if (!leaves[nodes[index].light]->sample(p, ls)) {
+                return false;
+            }
+            ls.pdf *= pmf;
+            return true;
+        }
+
+        double pdf(const point3& origin, const vec3& n, const point3& on_light) const {
+            return nodes.empty() ? 0 : pdf(0, origin, n, on_light);
+        }
+
+        // The light whose surface holds p, nullptr if none. Descends only into the boxes
+        // around p, like pdf().
+        const light* find(const point3& p) const {
+            return nodes.empty() ? nullptr : find(0, p);
+        }
+
+    private:
+        struct node {
+            light_bounds bounds;
+            int child[2] = {-1, -1};
+            int light = -1;   // index into leaves, -1 for inner nodes
+        };
+
+        std::vector<node> nodes;
+        std::vector<const light*> leaves;
+        std::vector<light_bounds> leaf_bounds;
+
+        int build(std::vector<int>& order, size_t start, size_t end) {
+            int index = static_cast<int>(nodes.size());
+            nodes.push_back(node());
+
+            if (end - start == 1) {
+                nodes[index].light = order[start];
+                nodes[index].bounds = leaf_bounds[order[start]];
+                return index;
+            }
+
+            aabb centroids;
+            for (size_t i = start; i < end; ++i) {
+                point3 c = leaf_bounds[order[i]].box.centroid();
+                centroids = aabb(centroids, aabb(c, c));
+            }
+            int axis = centroids.longest_axis();
+            auto mid = start + (end - start) / 2;
+            std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                [&](int a, int b) {
+                    return leaf_bounds[a].box.centroid()[axis] < leaf_bounds[b].box.centroid()[axis];
+                });
+
+            int left  = build(order, start, mid);
+            int right = build(order, mid, end);
+            nodes[index].child[0] = left;
+            nodes[index].child[1] = right;
+            nodes[index].bounds = light_bounds(nodes[left].bounds, nodes[right].bounds);
+            return index;
+        }
+
+        static bool near_box(const aabb& box, const point3& p) {
+            for (int a = 0; a < 3; ++a) {
+                const interval& ax = box.axis(a);
+                auto slack = 1e-4 * (ax.size() + fabs(ax.min) + fabs(ax.max)) + 1e-9;
+                if (p[a] < ax.min - slack || p[a] > ax.max + slack) return false;
+            }
+            return true;
+        }
+
+        const light* find(int index, const point3& p) const {
+            const node& nd = nodes[index];
+            if (nd.light >= 0) {
+                return leaves[nd.light]->on_light(p) ? leaves[nd.light] : nullptr;
+            }
+            for (int c : nd.child) {
+                if (near_box(nodes[c].bounds.box, p)) {
+                    if (const light* l = find(c, p)) return l;
+                }
+            }
+            return nullptr;
+        }
+
+        double pdf(int index, const point3& origin, const vec3& n, const point3& on_light) const {
+            const node& nd = nodes[index];
+            if (nd.light >= 0) {
+                return leaves[nd.light]->pdf_value(origin, on_light);
+            }
+            const node& a = nodes[nd.child[0]];
+            const node& b = nodes[nd.child[1]];
+            bool in_a = near_box(a.bounds.box, on_light);
+            bool in_b = near_box(b.bounds.box, on_light);
+            if (!in_a && !in_b) {
+                return 0;
+            }
+            auto ia = a.bounds.importance(origin, n);
+            auto ib = b.bounds.importance(origin, n);
+            if (ia + ib <= 0) {
+                return 0;
+            }
+            double result = 0;
+            if (in_a && ia > 0) result += ia / (ia + ib) * pdf(nd.child[0], origin, n, on_light);
+            if (in_b && ib > 0) result += ib / (ia + ib) * pdf(nd.child[1], origin, n, on_light);
+            return result;
+        }
+};
+
+class light_list {
+    public:
+        std::vector<shared_ptr<light>> lights;
+        std::vector<const light*> infinite;
+
+    public:
+        light_list() {}
+
+        void add(shared_ptr<light> l) {
+            lights.push_back(l);
+            if (l->is_infinite()) {
+                infinite.push_back(l.get());
+            }
+            tree.reset(); // stale, build_bvh() again.
+            separate.clear();
+        }
+
+        bool empty() const { return lights.empty(); }
+
+        // Builds the light hierarchy over the finite lights, call once the list is complete
+        // (next to building the geometry BVH). Without it lights are picked uniformly.
+        // Finite lights without bounds() stay out of the tree and are picked uniformly
+        // alongside the infinite ones, so they keep their share of next-event estimation.
+        void build_bvh() {
+            std::vector<shared_ptr<light>> bounded;
+            separate = infinite;
+            for (const auto& l : lights) {
+                if (l->is_infinite()) continue;
+                if (l->bounds().phi > 0) {
+                    bounded.push_back(l);
+                } else {
+                    separate.push_back(l.get());
+                }
+            }
+            tree = make_shared<light_bvh>(bounded);
+        }
+
+        // True if some light replaces the default sky for rays that escape.
+        bool has_background() const { return !infinite.empty(); }
+
+        color background(const vec3& dir) const {
+            color sum(0,0,0);
+            for (auto l : infinite) {
+                sum += l->Le(dir);
+            }
+            return sum;
+        }
+
+        // Solid angle pdf of light sampling producing an escaping ray along 'dir'.
+        double pdf_background(const vec3& dir) const {
+            double sum = 0;
+            for (auto l : infinite) {
+                sum += l->pdf_direction(dir);
+            }
+            auto count = choices();
+            return count > 0 ? sum / count : 0;
+        }
+
+        // Picks one light for the shading point p with normal n (0 if there is none).
+        // The returned pdf includes the selection probability.
+        bool sample(const point3& p, const vec3& n, light_sample& ls) const {
+            auto count = choices();
+            if (count == 0) {
+                return false;
+            }
+            auto index = std::min(count - 1, static_cast<size_t>(random_double() * count));
+            bool found;
+            if (!tree) {
+                found = lights[index]->sample(p, ls);
+            } else if (index < separate.size()) {
+                found = separate[index]->sample(p, ls);
+            } else {
+                found = tree->sample(p, n, ls);
+            }
+            if (!found) {
+                return false;
+            }
+            ls.pdf /= count;
+            return true;
+        }
+
+        // Pdf of sample() from 'origin' with normal n choosing the point 'on_light'.
+        double pdf_value(const point3& origin, const vec3& n, const point3& on_light) const {
+            auto count = choices();
+            if (count == 0) {
+                return 0;
+            }
+            if (tree) {
+                double sum = tree->pdf(origin, n, on_light);
+                for (auto l : separate) {
+                    sum += l->pdf_value(origin, on_light);
+                }
+                return sum / count;
+            }
+            double sum = 0;
+            for (const auto& l : lights) {
+                sum += l->pdf_value(origin, on_light);
+            }
+            return sum / lights.size();
+        }
+
+        // The light whose surface holds p (a hit on emissive geometry), nullptr if none.
+        // O(log n) through the tree once build_bvh() has run.
+        const light* find(const point3& p) const {
+            if (!tree) {
+                for (const auto& l : lights) {
+                    if (l->on_light(p)) return l.get();
+                }
+                return nullptr;
+            }
+            if (const light* l = tree->find(p)) {
+                return l;
+            }
+            for (auto l : separate) {
+                if (l->on_light(p)) return l;
+            }
+            return nullptr;
+        }
+
+    private:
+        shared_ptr<light_bvh> tree;
+        std::vector<const light*> separate;  // with a tree: the lights it doesn't hold
+
+        // With a tree: each separate light, or the tree as a whole.
+        size_t choices() const {
+            return tree ? separate.size() + (tree->empty() ? 0 : 1) : lights.size();
+        }
+};
+
+#endif
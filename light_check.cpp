@@ -0,0 +1,110 @@
+// Light selection check: light_list::sample() and pdf_value() have to agree, with and
+// without the light BVH. For every shading point the pdf of each sample has to equal
+// pdf_value() of the point it picked, the probability of choosing each sphere light
+// (its pdf times the solid angle it subtends) has to match how often it was sampled,
+// and the choices together, point light included, have to add up to one.
+//
+// Usage: ./light_check        prints the worst error per mode, exits 1 on any failure
+//
+// The scene mixes lights the tree holds with a zero-power sphere, which build_bvh()
+// keeps out of the tree and picks alongside it.
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "light.h"
+#include "vec3.h"
+
+using std::make_shared;
+
+struct sphere_spec {
+    point3 center;
+    double radius;
+};
+
+bool overlaps(const std::vector<sphere_spec>& spheres, const point3& p, double r) {
+    for (const auto& s : spheres) {
+        if ((s.center - p).length() < s.radius + r + 0.05) return true;
+    }
+    return false;
+}
+
+int main() {
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> u(0, 1);
+    auto uniform = [&](double a, double b) { return a + (b - a) * u(rng); };
+
+    std::vector<sphere_spec> spheres;
+    std::vector<shared_ptr<light>> sphere_lights;
+    while (spheres.size() < 48) {
+        point3 c(uniform(-6, 6), uniform(-6, 6), uniform(-6, 6));
+        double r = uniform(0.1, 0.4);
+        if (overlaps(spheres, c, r)) continue;
+        spheres.push_back({c, r});
+        // the last one emits nothing, so it has no power for the tree.
+        color emit = spheres.size() == 48 ? color(0, 0, 0) : color(uniform(0.5, 20), 1, 1);
+        sphere_lights.push_back(make_shared<sphere_light>(c, r, emit));
+    }
+    auto point = make_shared<point_light>(point3(0, 7, 0), color(30, 30, 30));
+
+    const int samples = 40000;
+    int failures = 0;
+    for (bool tree : {false, true}) {
+        light_list lights;
+        for (const auto& l : sphere_lights) lights.add(l);
+        lights.add(point);
+        if (tree) lights.build_bvh();
+
+        double worst_pdf = 0, worst_freq = 0, worst_sum = 0;
+        for (int s = 0; s < 30; ++s) {
+            point3 p;
+            do {
+                p = point3(uniform(-7, 7), uniform(-7, 7), uniform(-7, 7));
+            } while (overlaps(spheres, p, 0));
+            vec3 n = random_unit_vector();
+
+            // exact choice probabilities from the (constant over the cone) pdf.
+            std::vector<double> pmf(spheres.size());
+            double total = 0;
+            for (size_t k = 0; k < spheres.size(); ++k) {
+                const auto& sp = spheres[k];
+                double dist = (sp.center - p).length();
+                point3 nearest = sp.center - sp.radius * (sp.center - p) / dist;
+                double cos_max = std::sqrt(1 - sp.radius * sp.radius / (dist * dist));
+                pmf[k] = lights.pdf_value(p, n, nearest) * 2 * M_PI * (1 - cos_max);
+                total += pmf[k];
+            }
+
+            std::vector<int> picked(spheres.size(), 0);
+            int picked_point = 0;
+            for (int k = 0; k < samples; ++k) {
+                light_sample ls;
+                if (!lights.sample(p, n, ls)) continue;
+                if (ls.delta) { ++picked_point; continue; }
+                point3 on = p + ls.dist * ls.wi;
+                double expected = lights.pdf_value(p, n, on);
+                worst_pdf = std::max(worst_pdf, std::fabs(expected - ls.pdf) / ls.pdf);
+                for (size_t m = 0; m < spheres.size(); ++m) {
+                    if (sphere_lights[m]->on_light(on)) { ++picked[m]; break; }
+                }
+            }
+
+            for (size_t k = 0; k < spheres.size(); ++k) {
+                double freq = double(picked[k]) / samples;
+                double sigma = std::sqrt(pmf[k] * (1 - pmf[k]) / samples);
+                worst_freq = std::max(worst_freq, std::fabs(freq - pmf[k]) / (sigma + 1e-4));
+            }
+            // the point light's share is only known from its count, so allow for its noise.
+            double point_freq = double(picked_point) / samples;
+            double point_sigma = std::sqrt(point_freq * (1 - point_freq) / samples);
+            worst_sum = std::max(worst_sum, std::fabs(total + point_freq - 1) / (point_sigma + 1e-4));
+        }
+
+        // frequencies are compared in standard deviations of the binomial count.
+        bool ok = worst_pdf < 1e-9 && worst_freq < 5 && worst_sum < 5;
+        std::printf("%-8s  pdf mismatch %.1e  choice freq off by %.2f sigma  choices sum off by %.2f sigma%s\n",
+                    tree ? "bvh" : "uniform", worst_pdf, worst_freq, worst_sum, ok ? "" : "  FAIL");
+        failures += !ok;
+    }
+    return failures == 0 ? 0 : 1;
+}
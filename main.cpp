@@ -1,7 +1,14 @@
 #include <memory>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include "hittable_list.h"
 #include "camera.h"
+#include "animation.h"
+#include "bvh8.h"
+#include "preview.h"
+#include "environment.h"
+#include "autotune.h"
 #include "sphere.h"
 #include "mlem.h"
 #include "vec3.h"
@@ -12,13 +19,60 @@ using std::chrono::high_resolution_clock;
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
 
-int main() {
+int main(int argc, char* argv[]) {
+    // Usage: ./main                 single frame to stdout
+    //        ./main --animate N     N frame turntable, written to frame_XXXX.ppm
+    //        ./main --serve         interactive preview, commands on stdin (see preview.h)
+    //        ./main --env sky.pfm   light the scene with an equirectangular HDR map
+    //        ./main --tiled out.tif out-of-core render streamed into a tiled TIFF
+    //        ./main --autotune      pick thread count and block size first (cached in .autotune)
+    //        ./main --texture map.pfm wrap an RGB PFM image around the center sphere
+    //        ./main --raster        primary visibility from the binned raster pre-pass
+    //        ./main --cache         reuse diffuse radiance from a radiance cache (see radiance_cache.h)
+    int animate_frames = 0;
+    bool serve = false;
+    const char* env_path = nullptr;
+    const char* tiled_path = nullptr;
+    bool tune = false;
+    const char* texture_path = nullptr;
+    bool raster = false;
+    bool use_cache = false;
+    for (int a = 1; a < argc; ++a) {
+        if (!std::strcmp(argv[a], "--animate") && a + 1 < argc) {
+            animate_frames = std::atoi(argv[++a]);
+        } else if (!std::strcmp(argv[a], "--serve")) {
+            serve = true;
+        } else if (!std::strcmp(argv[a], "--env") && a + 1 < argc) {
+            env_path = argv[++a];
+        } else if (!std::strcmp(argv[a], "--tiled") && a + 1 < argc) {
+            tiled_path = argv[++a];
+        } else if (!std::strcmp(argv[a], "--autotune")) {
+            tune = true;
+        } else if (!std::strcmp(argv[a], "--raster")) {
+            raster = true;
+        } else if (!std::strcmp(argv[a], "--cache")) {
+            use_cache = true;
+        } else if (!std::strcmp(argv[a], "--texture") && a + 1 < argc) {
+            texture_path = argv[++a];
+        }
+    }
+
     auto material_ground = make_shared<lambertian>(color(0.9, 0.6, 0.7));
     auto material_center = make_shared<lambertian>(color(0.7, 0.2, 0.1));
     auto material_left   = make_shared<metal>(color(0.2, 0.7, 0.1), 0.3);
     auto material_right  = make_shared<dielectric>(1.5);
     auto material_top    = make_shared<metal>(color(1,1,1));
 
+    if (texture_path) {
+        auto textures = make_shared<texture_cache>();
+        auto map = image_texture::load(textures, texture_path);
+        if (map) {
+            material_center = make_shared<lambertian>(map);
+        } else {
+            std::cerr << "Can't read texture " << texture_path << std::endl;
+        }
+    }
+
     hittable_list world;
 
     world.add(make_shared<sphere>(point3(-1,0,-1),     0.5, material_left));
@@ -27,6 +81,8 @@ int main() {
     world.add(make_shared<sphere>(point3(0,-100.5,-1), 100, material_ground));
     world.add(make_shared<sphere>(point3(0,1.5,2),       2, material_top));
 
+    world = hittable_list(make_shared<bvh8>(world));
+
     camera cam;
 
     cam.aspect_ratio      = 16.0 / 9.0;
@@ -42,12 +98,49 @@ int main() {
     //cam.defocus_angle = 0.6;
     //cam.focus_dist    = 10.0;
     cam.block_size    = 32;
+    cam.raster_primary = raster;   // pinhole only, first hits from the raster pre-pass
+    if (use_cache) {
+        cam.cache = make_shared<radiance_cache>();
+    }
+
+    light_list lights;
+    if (env_path) {
+        auto env = environment_light::load(env_path);
+        if (!env) {
+            std::cerr << "Can't read environment map " << env_path << std::endl;
+            return 1;
+        }
+        lights.add(env);
+    }
+    lights.build_bvh();
+
+    if (tune) {
+        autotune_settings settings;
+        settings.cache_path = ".autotune";
+        auto tuned = autotune(cam, world, lights, settings);
+        std::cerr << "Autotune: " << tuned.threads << " threads, block size " << tuned.block_size
+                  << (tuned.from_cache ? " (cached)" : "") << std::endl;
+    }
+
+    if (serve) {
+        preview_server(cam, world, lights).serve(std::cin, std::cout);
+        return 0;
+    }
 
     // Start the timer
     auto start_time = high_resolution_clock::now();
 
     // Render the scene
-    cam.render(world);
+    if (animate_frames > 0) {
+        auto path = camera_path::orbit(cam.lookfrom, cam.lookat);
+        render_animation(cam, world, lights, path, animate_frames, "frame_%04d.ppm");
+    } else if (tiled_path) {
+        if (!cam.render_tiled(world, lights, tiled_path)) {
+            return 1;
+        }
+    } else {
+        cam.render(world, lights);
+    }
 
     // Stop the timer
     auto end_time = high_resolution_clock::now();
@@ -3,7 +3,9 @@
 
 #include "hittable.h"
 #include "mlem.h"
+#include "onb.h"
 #include "ray.h"
+#include "texture.h"
 #include "vec3.h"
 
 class material {
@@ -11,24 +13,66 @@ class material {
         virtual ~material() = default;
 
         virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+        virtual color emitted(const ray& r_in, const hit_record& rec) const {
+            return color(0,0,0);
+        }
+
+        // Surface color for the albedo AOV, used to guide the denoiser.
+        virtual color albedo_aov(const ray& r_in, const hit_record& rec) const {
+            return color(1,1,1);
+        }
+
+        // BSDF times cosine for an explicit direction, used for light sampling.
+        virtual color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return color(0,0,0);
+        }
+
+        // Solid angle pdf of scatter() picking 'direction'. 0 means a delta (specular) lobe,
+        // which can't be hit by light sampling.
+        virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const {
+            return 0;
+        }
+
+        // View independent reflection, which the radiance cache can stand in for.
+        virtual bool is_diffuse() const { return false; }
 };
 
 class lambertian : public material {
     private:
-        color albedo;
+        shared_ptr<texture> tex;
+
+        color albedo(const ray& r_in, const hit_record& rec) const {
+            return tex->value(rec.u, rec.v, uv_footprint(r_in, rec));
+        }
+
     public:
-        lambertian(const color& a) : albedo(a) {}
-        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-            auto scatter_direction = rec.normal + random_unit_vector();
+        lambertian(const color& a) : tex(make_shared<solid_color>(a)) {}
+        lambertian(shared_ptr<texture> t) : tex(t) {}
 
-            if (scatter_direction.near_zero()) {
-                scatter_direction = rec.normal;
-            }
+        color albedo_aov(const ray& r_in, const hit_record& rec) const override { return albedo(r_in, rec); }
 
-            scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo;
+        bool is_diffuse() const override { return true; }
+
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+            onb uvw(rec.normal);
+            auto scatter_direction = uvw.transform(sample_cosine_hemisphere(random_double(), random_double()));
+
+            scattered = ray(rec.p, scatter_direction, r_in.time());
+            attenuation = albedo(r_in, rec);
             return true;
         }
+
+        color eval(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+            auto pdf = scattering_pdf(r_in, rec, direction);
+            return pdf > 0 ? albedo(r_in, rec) * pdf : color(0,0,0);
+        }
+
+        double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+            // scatter() samples the cosine distribution.
+            auto cos_theta = dot(rec.normal, unit_vector(direction));
+            return cos_theta < 0 ? 0 : cos_theta / M_PI;
+        }
 };
 
 class metal : public material {
@@ -39,9 +83,11 @@ class metal : public material {
         metal(const color& a) : albedo(a) {}
         metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1){}
 
+        color albedo_aov(const ray& r_in, const hit_record& rec) const override { return albedo; }
+
         bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz * random_unit_vector());
+            scattered = ray(rec.p, reflected + fuzz * random_unit_vector(), r_in.time());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
@@ -75,10 +121,29 @@ class dielectric : public material {
                 direction = refract(unit_direction, rec.normal, refraction_ratio);
             }
 
-            scattered = ray(rec.p, direction);
+            scattered = ray(rec.p, direction, r_in.time());
             attenuation = color(1,1,1);
             return true;
         }
 };
 
+class diffuse_light : public material {
+    private:
+        color emit;
+    public:
+        diffuse_light(const color& c) : emit(c) {}
+
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+            return false;
+        }
+
+        color emitted(const ray& r_in, const hit_record& rec) const override {
+            // one-sided emitter, only the outward face glows.
+            if (!rec.front_face) {
+                return color(0,0,0);
+            }
+            return emit;
+        }
+};
+
 #endif // !MATERIAL_H
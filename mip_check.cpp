@@ -0,0 +1,193 @@
+// Mip pyramid check: the "<file>.mip" sidecar that texture_cache builds has to hold every
+// level as an area-weighted box filter of the one below, odd sizes included, for little
+// and big endian PFMs, so each level keeps the mean of the image. The sidecar has to be
+// reused while it is current, and rebuilt when the image is newer or the sidecar is cut
+// short. A constant texture has to look up as that constant at any footprint, and the
+// sphere's uv_per_unit must not understate how fast u or v change over its surface.
+//
+// Usage: ./mip_check          prints a line per case, exits 1 on any failure
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "hittable_list.h"
+#include "material.h"
+#include "pfm.h"
+#include "sphere.h"
+#include "texture_cache.h"
+
+using std::make_shared;
+
+// One level, rows in file order (bottom first), 3 floats per texel.
+struct level {
+    int width, height;
+    std::vector<double> rgb;
+};
+
+// Share of source texel k in target texel t when 'src' texels shrink to 'dst'.
+double overlap(int k, int t, int src, int dst) {
+    double lo = std::max(double(k) / src, double(t) / dst);
+    double hi = std::min(double(k + 1) / src, double(t + 1) / dst);
+    return std::max(0.0, hi - lo) * dst;
+}
+
+level downsample(const level& in) {
+    level out{(in.width + 1) / 2, (in.height + 1) / 2, {}};
+    out.rgb.assign(3 * size_t(out.width) * out.height, 0.0);
+    for (int t = 0; t < out.height; ++t) {
+        for (int s = 0; s < out.width; ++s) {
+            for (int m = 0; m < in.height; ++m) {
+                double wy = overlap(m, t, in.height, out.height);
+                if (wy == 0) continue;
+                for (int k = 0; k < in.width; ++k) {
+                    double w = wy * overlap(k, s, in.width, out.width);
+                    for (int c = 0; c < 3; ++c) {
+                        out.rgb[3 * (size_t(t) * out.width + s) + c] += w * in.rgb[3 * (size_t(m) * in.width + k) + c];
+                    }
+                }
+            }
+        }
+    }
+    // the sidecar stores floats, and each level is filtered from the stored one.
+    for (auto& v : out.rgb) v = float(v);
+    return out;
+}
+
+void write_raw_pfm(const std::string& path, const level& img, bool big_endian) {
+    std::ofstream out(path, std::ios::binary);
+    out << "PF\n" << img.width << ' ' << img.height << '\n' << (big_endian ? "1.0" : "-1.0") << '\n';
+    for (double v : img.rgb) {
+        float f = float(v);
+        unsigned char b[4];
+        std::memcpy(b, &f, 4);
+        if (big_endian == host_is_little_endian()) std::swap(b[0], b[3]), std::swap(b[1], b[2]);
+        out.write(reinterpret_cast<const char*>(b), 4);
+    }
+}
+
+time_t modified(const std::string& path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+}
+
+void set_modified(const std::string& path, time_t when) {
+    struct timeval times[2] = {{when, 0}, {when, 0}};
+    ::utimes(path.c_str(), times);
+}
+
+bool check_pyramid(std::mt19937& rng, int width, int height, bool big_endian) {
+    std::uniform_real_distribution<double> u(0, 4);
+    level base{width, height, {}};
+    for (size_t k = 0; k < 3 * size_t(width) * height; ++k) base.rgb.push_back(float(u(rng)));
+
+    const std::string path = "/tmp/mip_check.pfm", mip_path = path + ".mip";
+    std::remove(mip_path.c_str());
+    write_raw_pfm(path, base, big_endian);
+
+    texture_cache cache;
+    int id = cache.open(path);
+    bool ok = id >= 0;
+
+    // the sidecar: a 64 byte header, then levels 1 and up as float rows.
+    std::ifstream in(mip_path, std::ios::binary);
+    in.seekg(64);
+    double worst = 0, worst_mean = 0;
+    int count = 1;
+    level expected = base;
+    double base_mean = 0;
+    for (double v : base.rgb) base_mean += v / base.rgb.size();
+    while (ok && (expected.width > 1 || expected.height > 1)) {
+        expected = downsample(expected);
+        std::vector<float> stored(expected.rgb.size());
+        ok = ok && static_cast<bool>(in.read(reinterpret_cast<char*>(stored.data()), stored.size() * sizeof(float)));
+        double mean = 0;
+        for (size_t k = 0; ok && k < stored.size(); ++k) {
+            worst = std::max(worst, std::fabs(stored[k] - expected.rgb[k]) / std::max(1e-6, std::fabs(expected.rgb[k])));
+            mean += stored[k] / stored.size();
+        }
+        worst_mean = std::max(worst_mean, std::fabs(mean - base_mean) / base_mean);
+        ++count;
+    }
+    ok = ok && count == cache.levels(id) && worst < 1e-5 && worst_mean < 1e-5;
+    std::printf("pyramid  %4dx%-4d %s  %d levels  max rel error %.1e  mean drift %.1e%s\n", width, height,
+                big_endian ? "big   " : "little", count, worst, worst_mean, ok ? "" : "  FAIL");
+    std::remove(path.c_str());
+    std::remove(mip_path.c_str());
+    return ok;
+}
+
+bool check_reuse() {
+    const std::string path = "/tmp/mip_check_reuse.pfm", mip_path = path + ".mip";
+    std::remove(mip_path.c_str());
+    std::vector<color> pixels(33 * 17, color(0.25, 0.5, 2));
+    write_pfm(path, 33, 17, pixels);
+    set_modified(path, 1000000000);
+    auto rebuilt = [&]() {
+        // an old timestamp on the sidecar shows whether open() wrote it again.
+        set_modified(mip_path, 1000000001);
+        texture_cache cache;
+        int id = cache.open(path);
+        return id >= 0 && modified(mip_path) != 1000000001;
+    };
+
+    bool built = [&]() { texture_cache cache; return cache.open(path) >= 0; }() && modified(mip_path) != 0;
+    bool reused = !rebuilt();
+    set_modified(path, 1000000002);           // the image is newer than the sidecar
+    bool stale = [&]() { texture_cache cache; return cache.open(path) >= 0; }()
+              && modified(mip_path) != 1000000001;
+    ::truncate(mip_path.c_str(), 10);         // cut short, the header no longer matches
+    set_modified(path, 1000000000);
+    bool truncated = rebuilt();
+
+    // a constant image looks up as itself at every footprint.
+    texture_cache cache;
+    int id = cache.open(path);
+    double worst = 0;
+    for (double footprint : {0.0, 0.01, 0.1, 0.5, 1.0, 10.0}) {
+        color c = cache.lookup(id, 0.37, 0.81, footprint);
+        worst = std::max(worst, (c - pixels[0]).length());
+    }
+    bool ok = built && reused && stale && truncated && worst < 1e-6;
+    std::printf("sidecar  built %s  reused %s  rebuilt when stale %s  rebuilt when cut short %s  constant lookup error %.1e%s\n",
+                built ? "yes" : "no", reused ? "yes" : "no", stale ? "yes" : "no", truncated ? "yes" : "no", worst,
+                ok ? "" : "  FAIL");
+    std::remove(path.c_str());
+    std::remove(mip_path.c_str());
+    return ok;
+}
+
+bool check_sphere_scale() {
+    // uv change per unit of surface distance, measured along a meridian and along the equator.
+    const double radius = 2.5, step = 1e-4;
+    sphere ball(point3(0, 0, 0), radius, make_shared<lambertian>(color(1, 1, 1)));
+    auto uv_at = [&](double theta, double phi, hit_record& rec) {
+        vec3 n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+        ray r(3 * radius * n, -n);
+        ball.hit(r, interval(0.001, infinity), rec);
+    };
+    hit_record a, b, c;
+    uv_at(M_PI / 2, 1.0, a);
+    uv_at(M_PI / 2 + step / radius, 1.0, b);
+    uv_at(M_PI / 2, 1.0 + step / radius, c);
+    double dv = std::fabs(b.v - a.v) / step, du = std::fabs(c.u - a.u) / step;
+    bool ok = a.uv_per_unit >= std::max(du, dv) * (1 - 1e-6);
+    std::printf("sphere   du/ds %.5f  dv/ds %.5f  uv_per_unit %.5f%s\n", du, dv, a.uv_per_unit, ok ? "" : "  FAIL");
+    return ok;
+}
+
+int main() {
+    std::mt19937 rng(23);
+    int failures = 0;
+    failures += !check_pyramid(rng, 64, 32, false);
+    failures += !check_pyramid(rng, 37, 23, false);
+    failures += !check_pyramid(rng, 37, 23, true);
+    failures += !check_pyramid(rng, 1, 9, false);
+    failures += !check_pyramid(rng, 100, 3, true);
+    failures += !check_reuse();
+    failures += !check_sphere_scale();
+    return failures == 0 ? 0 : 1;
+}
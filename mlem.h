@@ -22,10 +22,8 @@ double degrees_to_radians(double deg){
 }
 
 double random_double(double min = 0.0, double max = 1.0) {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_real_distribution<> dis(min, max);
-    return dis(gen);
+    // per thread generator, render threads never share state.
+    return min + (max - min) * dist(gen);
 }
 
 // Constants
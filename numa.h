@@ -0,0 +1,135 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include "vec3.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+// CPUs per NUMA node, read from sysfs. Machines without NUMA information (or other
+// platforms) show up as a single node holding every CPU.
+class numa_topology {
+    public:
+        std::vector<std::vector<int>> node_cpus;
+
+    public:
+        static const numa_topology& system() {
+            static const numa_topology topology;
+            return topology;
+        }
+
+        int nodes() const { return static_cast<int>(node_cpus.size()); }
+
+    private:
+        numa_topology() {
+#if defined(__linux__)
+            for (int node = 0; ; ++node) {
+                std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                if (!file) break;
+                std::string list;
+                std::getline(file, list);
+                auto cpus = parse_cpulist(list);
+                if (!cpus.empty()) {
+                    node_cpus.push_back(cpus);
+                }
+            }
+#endif
+            if (node_cpus.empty()) {
+                node_cpus.emplace_back();
+                int count = std::max(1u, std::thread::hardware_concurrency());
+                for (int cpu = 0; cpu < count; ++cpu) {
+                    node_cpus[0].push_back(cpu);
+                }
+            }
+        }
+
+        static std::vector<int> parse_cpulist(const std::string& list) {
+            // "0-3,8-11" style ranges.
+            std::vector<int> cpus;
+            std::stringstream ranges(list);
+            std::string range;
+            while (std::getline(ranges, range, ',')) {
+                if (range.empty()) continue;
+                auto dash = range.find('-');
+                int first = std::atoi(range.substr(0, dash).c_str());
+                int last = (dash == std::string::npos) ? first : std::atoi(range.substr(dash + 1).c_str());
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            }
+            return cpus;
+        }
+};
+
+// Restricts the calling thread to 'cpus'. Returns false where affinity isn't supported.
+inline bool pin_current_thread(const std::vector<int>& cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// Allocator that leaves default-constructed elements untouched, so the pages of a large
+// buffer get placed on the NUMA node of the thread that writes them first, not on the
+// node of the thread that resized it. Only for trivially destructible element types
+// that are always written before they're read.
+template <class T>
+struct first_touch_allocator {
+    using value_type = T;
+
+    first_touch_allocator() = default;
+    template <class U> first_touch_allocator(const first_touch_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+#if defined(__linux__)
+        // fresh anonymous pages aren't backed by memory until first written.
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) throw std::bad_alloc();
+#else
+        void* p = std::malloc(bytes);
+        if (!p) throw std::bad_alloc();
+#endif
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n) {
+#if defined(__linux__)
+        munmap(p, n * sizeof(T));
+#else
+        std::free(p);
+#endif
+    }
+
+    template <class U> void construct(U* p) {}  // no first touch here.
+
+    template <class U, class... Args> void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <class U> bool operator==(const first_touch_allocator<U>&) const { return true; }
+    template <class U> bool operator!=(const first_touch_allocator<U>&) const { return false; }
+};
+
+// Frame buffer whose pages are placed by the render threads writing each tile.
+using color_buffer = std::vector<color, first_touch_allocator<color>>;
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "vec3.h"
+
+// Orthonormal basis built around a single direction (the w axis).
+class onb {
+    public:
+        vec3 axis[3];
+
+    public:
+        onb() {}
+        onb(const vec3& n) {
+            // branch-free frame (Duff et al. 2017), no second normalize.
+            axis[2] = unit_vector(n);
+            auto z = axis[2].z();
+            auto sign = std::copysign(1.0, z);
+            auto a = -1 / (sign + z);
+            auto b = axis[2].x() * axis[2].y() * a;
+            axis[0] = vec3(1 + sign * axis[2].x() * axis[2].x() * a, sign * b, -sign * axis[2].x());
+            axis[1] = vec3(b, sign + axis[2].y() * axis[2].y() * a, -axis[2].y());
+        }
+
+        const vec3& u() const { return axis[0]; }
+        const vec3& v() const { return axis[1]; }
+        const vec3& w() const { return axis[2]; }
+
+        vec3 transform(const vec3& a) const {
+            // local (a.x, a.y, a.z) coordinates to world space.
+            return (a[0] * axis[0]) + (a[1] * axis[1]) + (a[2] * axis[2]);
+        }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef PFM_H
+#define PFM_H
+
+#include "vec3.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Portable float map (PFM) images: a text header "PF\n<w> <h>\n<scale>\n" then raw float
+// RGB rows, bottom row first. A negative scale means little-endian data.
+
+inline bool host_is_little_endian() {
+    uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+bool write_pfm(const std::string& path, int width, int height, const std::vector<color>& pixels) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+
+    out << "PF\n" << width << ' ' << height << '\n' << (host_is_little_endian() ? "-1.0" : "1.0") << '\n';
+
+    std::vector<float> row(3 * width);
+    for (int j = height - 1; j >= 0; --j) {
+        for (int i = 0; i < width; ++i) {
+            const color& c = pixels[j * width + i];
+            row[3*i]     = static_cast<float>(c.x());
+            row[3*i + 1] = static_cast<float>(c.y());
+            row[3*i + 2] = static_cast<float>(c.z());
+        }
+        out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+    return static_cast<bool>(out);
+}
+
+// Reads an RGB ("PF") map into top-row-first pixels. Returns false on anything else.
+bool read_pfm(const std::string& path, int& width, int& height, std::vector<color>& pixels) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    std::string magic;
+    double scale;
+    in >> magic >> width >> height >> scale;
+    in.get(); // single whitespace before the data.
+    if (!in || magic != "PF" || width <= 0 || height <= 0) return false;
+
+    const bool swap = (scale < 0) != host_is_little_endian();
+
+    pixels.assign(size_t(width) * height, color(0,0,0));
+    std::vector<float> row(3 * width);
+    for (int j = height - 1; j >= 0; --j) {
+        if (!in.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float))) return false;
+        for (int i = 0; i < width; ++i) {
+            float v[3];
+            for (int c = 0; c < 3; ++c) {
+                v[c] = row[3*i + c];
+                if (swap) {
+                    unsigned char b[4];
+                    std::memcpy(b, &v[c], 4);
+                    std::swap(b[0], b[3]);
+                    std::swap(b[1], b[2]);
+                    std::memcpy(&v[c], b, 4);
+                }
+            }
+            pixels[j * width + i] = color(v[0], v[1], v[2]);
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,129 @@
+// Photon map check: gather() has to find the same k nearest photons as a brute force
+// search, for trees of every shape from a single photon up, and fall back to the full
+// search radius when fewer than k photons are in reach. light_list::find(), which the
+// renderer uses to tell whether the map carries a light, has to name the light under a
+// point on its surface, with and without the light BVH, and nothing elsewhere.
+//
+// Usage: ./photon_check       prints the worst error per case, exits 1 on any failure
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+#include "hittable_list.h"
+#include "light.h"
+#include "material.h"
+#include "photon_map.h"
+#include "vec3.h"
+
+using std::make_shared;
+
+// What gather() should return for a lambertian surface facing every photon:
+// albedo / pi * (sum of the k nearest powers) / (pi r_k^2).
+color brute_force(const std::vector<photon>& photons, const point3& p, size_t k, double max_radius,
+                  const color& albedo) {
+    std::vector<std::pair<float, size_t>> near;
+    for (size_t i = 0; i < photons.size(); ++i) {
+        float d2 = 0;
+        for (int a = 0; a < 3; ++a) {
+            float d = float(p[a]) - photons[i].position[a];
+            d2 += d * d;
+        }
+        if (d2 < float(max_radius * max_radius)) near.emplace_back(d2, i);
+    }
+    if (near.empty()) return color(0, 0, 0);
+    std::sort(near.begin(), near.end());
+    if (near.size() > k) near.resize(k);
+    double r2 = near.size() == k ? near.back().first : max_radius * max_radius;
+    color sum(0, 0, 0);
+    for (const auto& n : near) {
+        const photon& ph = photons[n.second];
+        sum += color(ph.power[0], ph.power[1], ph.power[2]);
+    }
+    return albedo / M_PI * sum / (M_PI * r2);
+}
+
+bool check_gather(std::mt19937& rng, size_t count, size_t k, double max_radius) {
+    std::uniform_real_distribution<float> u(-1, 1), power(0.1f, 2.0f);
+    std::vector<photon> photons(count);
+    for (auto& ph : photons) {
+        for (int a = 0; a < 3; ++a) {
+            ph.position[a] = u(rng);
+            ph.power[a] = power(rng);
+        }
+        // all arrive straight down onto the +y facing test surface.
+        ph.direction[0] = 0; ph.direction[1] = -1; ph.direction[2] = 0;
+        ph.axis = 0;
+    }
+    photon_map map;
+    map.add(photons);
+    map.build();
+
+    const color albedo(0.5, 0.7, 0.9);
+    hit_record rec;
+    rec.normal = vec3(0, 1, 0);
+    rec.front_face = true;
+    rec.mat = make_shared<lambertian>(albedo);
+
+    double worst = 0;
+    for (int q = 0; q < 300; ++q) {
+        rec.p = point3(1.2 * u(rng), 1.2 * u(rng), 1.2 * u(rng));
+        ray r(rec.p + vec3(0, 1, 0), vec3(0, -1, 0));
+        color got = map.gather(r, rec, int(k), max_radius);
+        color expected = brute_force(photons, rec.p, k, max_radius, albedo);
+        for (int a = 0; a < 3; ++a) {
+            worst = std::max(worst, std::fabs(got[a] - expected[a]) / std::max(1e-9, std::fabs(expected[a])));
+        }
+    }
+    bool ok = worst < 1e-5;
+    std::printf("gather   %6zu photons  k=%-3zu radius %.2f  max rel error %.1e%s\n", count, k, max_radius,
+                worst, ok ? "" : "  FAIL");
+    return ok;
+}
+
+bool check_find(std::mt19937& rng) {
+    std::uniform_real_distribution<double> u(-5, 5);
+    light_list lights;
+    std::vector<std::pair<point3, double>> spheres;
+    for (int k = 0; k < 40; ++k) {
+        point3 c(2.5 * (k % 4), 2.5 * ((k / 4) % 4), 2.5 * (k / 16));
+        double r = 0.2 + 0.02 * k;
+        spheres.push_back({c, r});
+        lights.add(make_shared<sphere_light>(c, r, color(k == 39 ? 0 : 4, 4, 4)));  // the last one outside the tree
+    }
+    lights.add(make_shared<point_light>(point3(0, 9, 0), color(1, 1, 1)));
+
+    int wrong = 0;
+    for (bool tree : {false, true}) {
+        if (tree) lights.build_bvh();
+        for (size_t k = 0; k < spheres.size(); ++k) {
+            for (int s = 0; s < 20; ++s) {
+                point3 on = spheres[k].first + spheres[k].second * random_unit_vector();
+                wrong += lights.find(on) != lights.lights[k].get();
+            }
+            wrong += lights.find(spheres[k].first) != nullptr;  // the center isn't on the surface
+        }
+        for (int s = 0; s < 200; ++s) {
+            point3 p(u(rng), u(rng), u(rng));
+            bool on_any = false;
+            for (const auto& sp : spheres) on_any = on_any || std::fabs((p - sp.first).length() - sp.second) < 1e-3;
+            if (!on_any) wrong += lights.find(p) != nullptr;
+        }
+    }
+    std::printf("find     %zu lights  %d wrong%s\n", lights.lights.size(), wrong, wrong == 0 ? "" : "  FAIL");
+    return wrong == 0;
+}
+
+int main() {
+    std::mt19937 rng(17);
+    int failures = 0;
+    for (size_t count : {1, 2, 3, 7, 100, 5000}) {
+        failures += !check_gather(rng, count, 16, 0.5);
+    }
+    failures += !check_gather(rng, 5000, 1, 0.3);
+    failures += !check_gather(rng, 5000, 64, 0.05);  // mostly fewer than k in reach
+    failures += !check_gather(rng, 20000, 200, 2.0);
+    failures += !check_find(rng);
+    return failures == 0 ? 0 : 1;
+}
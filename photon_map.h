@@ -0,0 +1,221 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "alias_table.h"
+#include "hittable.h"
+#include "light.h"
+#include "material.h"
+#include "mlem.h"
+#include "thread_pool.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+struct photon {
+    float  position[3];
+    float  power[3];
+    float  direction[3];  // travel direction, towards the surface
+    int8_t axis;          // kd-tree split axis of this node
+};
+
+// Caustic photon map: photons that reached a diffuse surface through one or more
+// specular bounces (L S+ D paths), in a kd-tree stored implicitly in one array: each
+// range is split at its median along its widest axis, and the median photon is the node.
+// Built once, read-only while rendering.
+class photon_map {
+    public:
+        photon_map() {}
+
+        void add(const std::vector<photon>& batch) {
+            photons.insert(photons.end(), batch.begin(), batch.end());
+        }
+
+        // Shoots 'count' photons from the lights, picked in proportion to their power, in
+        // parallel on 'pool', keeps the ones that reach a diffuse surface after at least one
+        // specular bounce and builds the tree. Each photon leaves at a random time in
+        // [time0, time1], so moving objects cast their caustics over the whole shutter.
+        void emit(const hittable& world, const light_list& lights, int count, int max_depth,
+                  double time0, double time1, thread_pool& pool) {
+            std::vector<const light*> emitters;
+            std::vector<double> power;
+            for (const auto& l : lights.lights) {
+                auto phi = l->bounds().phi;
+                ray probe;
+                color probe_flux;
+                if (!l->is_infinite() && phi > 0 && l->sample_emission(probe, probe_flux)) {
+                    emitters.push_back(l.get());
+                    power.push_back(phi);
+                }
+            }
+            if (emitters.empty() || count <= 0) {
+                return;
+            }
+            sources = emitters;
+            std::sort(sources.begin(), sources.end());
+            const alias_table pick(power);
+
+            const int chunk = 4096;
+            std::mutex merge;
+            pool.run((count + chunk - 1) / chunk, [&](int c) {
+                std::vector<photon> local;
+                const int n = std::min(count, (c + 1) * chunk) - c * chunk;
+                for (int i = 0; i < n; ++i) {
+                    auto index = pick.sample(random_double());
+                    ray r;
+                    color flux;
+                    if (!emitters[index]->sample_emission(r, flux)) continue;
+                    flux /= count * pick.probability(index);
+                    double time = time0 + (time1 - time0) * random_double();
+                    trace(world, ray(r.origin(), r.direction(), time), flux, max_depth, local);
+                }
+                std::lock_guard<std::mutex> lock(merge);
+                add(local);
+            });
+            build();
+        }
+
+        // Balances the tree, call after the last add().
+        void build() {
+            if (!photons.empty()) {
+                build(0, photons.size());
+            }
+        }
+
+        size_t size() const { return photons.size(); }
+
+        // True if photons were shot from 'l' (see light_list::find()), so the map carries
+        // its caustics and the path tracer must not count them again.
+        bool carries(const light* l) const {
+            return l && std::binary_search(sources.begin(), sources.end(), l);
+        }
+
+        // Density estimate of the caustic radiance leaving 'rec' towards -r.direction() from
+        // the k nearest photons within max_radius: sum f * power / (pi r_k^2).
+        color gather(const ray& r, const hit_record& rec, int k, double max_radius) const {
+            if (photons.empty() || k <= 0) {
+                return color(0,0,0);
+            }
+            thread_local std::vector<std::pair<float, uint32_t>> heap;  // max-heap on distance^2
+            heap.clear();
+            const float p[3] = {float(rec.p.x()), float(rec.p.y()), float(rec.p.z())};
+            float radius2 = static_cast<float>(max_radius * max_radius);
+            search(0, photons.size(), p, static_cast<size_t>(k), radius2, heap);
+            if (heap.empty()) {
+                return color(0,0,0);
+            }
+
+            // with fewer than k photons in reach, the estimate uses the full search radius.
+            double r2 = heap.size() == static_cast<size_t>(k) ? heap.front().first : max_radius * max_radius;
+            color sum(0,0,0);
+            for (const auto& entry : heap) {
+                const photon& ph = photons[entry.second];
+                vec3 wi(-ph.direction[0], -ph.direction[1], -ph.direction[2]);
+                auto cos_i = dot(wi, rec.normal);
+                if (cos_i <= 0) continue;
+                // eval() is the BSDF times the cosine, the photon density already has it.
+                color f = rec.mat->eval(r, rec, wi) / cos_i;
+                sum += f * color(ph.power[0], ph.power[1], ph.power[2]);
+            }
+            return sum / (M_PI * r2);
+        }
+
+    private:
+        std::vector<photon> photons;
+        std::vector<const light*> sources;  // sorted
+
+        static void trace(const hittable& world, ray r, color flux, int max_depth, std::vector<photon>& out) {
+            bool specular = false;
+            for (int bounce = 0; bounce < max_depth; ++bounce) {
+                hit_record rec;
+                if (!world.hit(r, interval(0.001, infinity), rec)) return;
+                if (rec.mat->is_diffuse()) {
+                    if (specular) {
+                        vec3 d = unit_vector(r.direction());
+                        photon ph;
+                        for (int a = 0; a < 3; ++a) {
+                            ph.position[a] = static_cast<float>(rec.p[a]);
+                            ph.power[a] = static_cast<float>(flux[a]);
+                            ph.direction[a] = static_cast<float>(d[a]);
+                        }
+                        ph.axis = 0;
+                        out.push_back(ph);
+                    }
+                    return;  // direct and diffuse light is the path tracer's job.
+                }
+                color attenuation;
+                ray scattered;
+                if (!rec.mat->scatter(r, rec, attenuation, scattered)) return;
+                flux = flux * attenuation;
+                r = scattered;
+                specular = true;
+            }
+        }
+
+        void build(size_t start, size_t end) {
+            if (end - start < 1) return;
+            float lo[3] = {infinity_f(), infinity_f(), infinity_f()};
+            float hi[3] = {-infinity_f(), -infinity_f(), -infinity_f()};
+            for (size_t i = start; i < end; ++i) {
+                for (int a = 0; a < 3; ++a) {
+                    lo[a] = std::min(lo[a], photons[i].position[a]);
+                    hi[a] = std::max(hi[a], photons[i].position[a]);
+                }
+            }
+            int axis = 0;
+            for (int a = 1; a < 3; ++a) {
+                if (hi[a] - lo[a] > hi[axis] - lo[axis]) axis = a;
+            }
+            size_t mid = start + (end - start) / 2;
+            std::nth_element(photons.begin() + start, photons.begin() + mid, photons.begin() + end,
+                [axis](const photon& a, const photon& b) { return a.position[axis] < b.position[axis]; });
+            photons[mid].axis = static_cast<int8_t>(axis);
+            build(start, mid);
+            build(mid + 1, end);
+        }
+
+        static float infinity_f() { return std::numeric_limits<float>::infinity(); }
+
+        static bool farther(const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) {
+            return a.first < b.first;
+        }
+
+        void search(size_t start, size_t end, const float p[3], size_t k, float& radius2,
+                    std::vector<std::pair<float, uint32_t>>& heap) const {
+            if (start >= end) return;
+            size_t mid = start + (end - start) / 2;
+            const photon& node = photons[mid];
+            const int axis = node.axis;
+            float plane = p[axis] - node.position[axis];
+
+            // nearer side first, the far side only if the current radius reaches across.
+            if (plane < 0) {
+                search(start, mid, p, k, radius2, heap);
+                if (plane * plane < radius2) search(mid + 1, end, p, k, radius2, heap);
+            } else {
+                search(mid + 1, end, p, k, radius2, heap);
+                if (plane * plane < radius2) search(start, mid, p, k, radius2, heap);
+            }
+
+            float d2 = 0;
+            for (int a = 0; a < 3; ++a) {
+                float d = p[a] - node.position[a];
+                d2 += d * d;
+            }
+            if (d2 >= radius2) return;
+            heap.emplace_back(d2, static_cast<uint32_t>(mid));
+            std::push_heap(heap.begin(), heap.end(), farther);
+            if (heap.size() > k) {
+                std::pop_heap(heap.begin(), heap.end(), farther);
+                heap.pop_back();
+            }
+            if (heap.size() == k) {
+                radius2 = heap.front().first;  // only closer photons can still get in
+            }
+        }
+};
+
+#endif
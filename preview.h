@@ -0,0 +1,118 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "hittable.h"
+#include "camera.h"
+#include "light.h"
+
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Long running look-dev session: the scene and the render threads stay resident and
+// commands come in one per line, so re-rendering a small crop costs milliseconds.
+//
+//   set lookfrom|lookat|vup <x> <y> <z>
+//   set vfov|defocus_angle|focus_dist|aspect_ratio <value>
+//   set image_width|max_depth <value>
+//   render <x> <y> <w> <h> <spp>
+//   quit
+//
+// 'set' answers "OK". 'render' answers "TILE <x> <y> <w> <h>" followed by w*h*3 float32
+// linear RGB values (native byte order, row major). Errors answer "ERR <reason>".
+class preview_server {
+    private:
+        camera& cam;
+        const hittable& world;
+        const light_list& lights;
+
+        bool set_field(std::istringstream& args) {
+            std::string field;
+            args >> field;
+
+            if (field == "lookfrom" || field == "lookat" || field == "vup") {
+                double x, y, z;
+                if (!(args >> x >> y >> z)) return false;
+                point3 lookfrom = cam.lookfrom, lookat = cam.lookat;
+                vec3 vup = cam.vup;
+                point3& target = (field == "lookfrom") ? lookfrom : (field == "lookat") ? lookat : vup;
+                target = point3(x, y, z);
+                // the camera needs a view direction, and an up vector off that direction.
+                vec3 view = lookfrom - lookat;
+                auto side2 = cross(vup, view).length_squared();
+                if (!(view.length_squared() > 0) || !(side2 > 1e-12 * view.length_squared() * vup.length_squared())) {
+                    return false;
+                }
+                cam.lookfrom = lookfrom;
+                cam.lookat = lookat;
+                cam.vup = vup;
+                return true;
+            }
+
+            double value;
+            if (!(args >> value)) return false;
+
+            // reject values the camera can't build a viewport from.
+            if      (field == "vfov"          && value > 0 && value < 180) cam.vfov = value;
+            else if (field == "defocus_angle" && value >= 0 && value < 180) cam.defocus_angle = value;
+            else if (field == "focus_dist"    && value > 0)                 cam.focus_dist = value;
+            else if (field == "aspect_ratio"  && value > 0 && value <= 1e4) cam.aspect_ratio = value;
+            else if (field == "image_width"   && value >= 1 && value <= 1 << 16) cam.image_width = static_cast<int>(value);
+            else if (field == "max_depth"     && value >= 0 && value <= 1 << 10) cam.max_depth = static_cast<int>(value);
+            else return false;
+            return true;
+        }
+
+        void render_tile(std::istringstream& args, std::ostream& out) {
+            int x, y, w, h, spp;
+            if (!(args >> x >> y >> w >> h >> spp) || w <= 0 || h <= 0 || spp <= 0) {
+                out << "ERR usage: render <x> <y> <w> <h> <spp>" << std::endl;
+                return;
+            }
+
+            if (!cam.render_region(world, lights, x, y, w, h, spp, tile)) {
+                out << "ERR crop outside the " << cam.image_width << 'x' << cam.output_height() << " image" << std::endl;
+                return;
+            }
+
+            pixels.resize(tile.size() * 3);
+            for (size_t k = 0; k < tile.size(); ++k) {
+                pixels[3*k]     = static_cast<float>(tile[k].x());
+                pixels[3*k + 1] = static_cast<float>(tile[k].y());
+                pixels[3*k + 2] = static_cast<float>(tile[k].z());
+            }
+
+            out << "TILE " << x << ' ' << y << ' ' << w << ' ' << h << '\n';
+            out.write(reinterpret_cast<const char*>(pixels.data()), pixels.size() * sizeof(float));
+            out.flush();
+        }
+
+        std::vector<color> tile;
+        std::vector<float> pixels;
+
+    public:
+        preview_server(camera& c, const hittable& w, const light_list& l) : cam(c), world(w), lights(l) {}
+
+        void serve(std::istream& in, std::ostream& out) {
+            std::string line;
+            while (std::getline(in, line)) {
+                std::istringstream args(line);
+                std::string command;
+                if (!(args >> command)) continue;
+
+                if (command == "quit") {
+                    break;
+                } else if (command == "set") {
+                    out << (set_field(args) ? "OK" : "ERR bad field or value") << std::endl;
+                } else if (command == "render") {
+                    render_tile(args, out);
+                } else {
+                    out << "ERR unknown command " << command << std::endl;
+                }
+            }
+        }
+};
+
+#endif
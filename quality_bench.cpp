@@ -0,0 +1,284 @@
+// Equal-time image quality benchmark.
+//
+// For each benchmark scene a high spp reference is rendered once and cached as a PFM in
+// the cache directory. The configuration under test then renders progressively, one pass
+// at a time, and the RMSE / relMSE against the reference is logged after every pass. The
+// CSV on stdout is the convergence-versus-time curve; rows with pass == "budget" give the
+// quality reached at each wall-clock budget.
+//
+// Usage: ./quality_bench [scene=all|spheres|random|lit] [budgets=1,10,60] [references=bench_cache]
+//                        [ref_spp=4096] [pass_spp=1] [camera settings ...]
+// Camera settings are key=value pairs: width, max_depth, lights (0/1), denoise (0/1),
+// defocus_angle, block_size, cache (0/1, radiance cache kept across the passes), cache_bounce.
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include "hittable_list.h"
+#include "camera.h"
+#include "bvh8.h"
+#include "pfm.h"
+#include "sphere.h"
+#include "mlem.h"
+#include "vec3.h"
+#include "material.h"
+
+using std::make_shared;
+
+// Bump when a renderer change alters converged images, so cached references are redone.
+const int renderer_version = 1;
+// Path depth of the reference renders.
+const int reference_depth = 50;
+
+struct bench_scene {
+    std::string  name;
+    int          version = 1;   // bump when the scene's content changes
+    hittable_list world;
+    light_list   lights;
+    camera       cam;
+};
+
+bench_scene spheres_scene() {
+    // The main.cpp scene.
+    bench_scene s;
+    s.name = "spheres";
+    s.world.add(make_shared<sphere>(point3(-1,0,-1),     0.5, make_shared<metal>(color(0.2, 0.7, 0.1), 0.3)));
+    s.world.add(make_shared<sphere>(point3(0,0,-1),      0.5, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    s.world.add(make_shared<sphere>(point3(1,0,-1),      0.5, make_shared<dielectric>(1.5)));
+    s.world.add(make_shared<sphere>(point3(0,-100.5,-1), 100, make_shared<lambertian>(color(0.9, 0.6, 0.7))));
+    s.world.add(make_shared<sphere>(point3(0,1.5,2),       2, make_shared<metal>(color(1,1,1), 0.0)));
+    s.cam.vfov     = 14;
+    s.cam.lookfrom = point3(10, 5, -12);
+    s.cam.lookat   = point3(0, 0, 0);
+    return s;
+}
+
+bench_scene random_scene() {
+    // Many small spheres, fixed seed so the reference stays valid.
+    bench_scene s;
+    s.name = "random";
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> u(0, 1);
+
+    s.world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = u(rng);
+            point3 center(a + 0.9 * u(rng), 0.2, b + 0.9 * u(rng));
+            shared_ptr<material> mat;
+            if (choose_mat < 0.8) {
+                mat = make_shared<lambertian>(color(u(rng) * u(rng), u(rng) * u(rng), u(rng) * u(rng)));
+            } else if (choose_mat < 0.95) {
+                mat = make_shared<metal>(color(0.5 + 0.5 * u(rng), 0.5 + 0.5 * u(rng), 0.5 + 0.5 * u(rng)), 0.5 * u(rng));
+            } else {
+                mat = make_shared<dielectric>(1.5);
+            }
+            s.world.add(make_shared<sphere>(center, 0.2, mat));
+        }
+    }
+    s.world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
+    s.world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+    s.world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, make_shared<metal>(color(0.7, 0.6, 0.5), 0.0)));
+    s.cam.vfov     = 20;
+    s.cam.lookfrom = point3(13, 2, 3);
+    s.cam.lookat   = point3(0, 0, 0);
+    return s;
+}
+
+bench_scene lit_scene() {
+    // Small bright light over diffuse spheres, the case light sampling is for.
+    bench_scene s;
+    s.name = "lit";
+    auto light_color = color(60, 55, 50);
+    s.world.add(make_shared<sphere>(point3(0,-100.5,-1), 100, make_shared<lambertian>(color(0.6, 0.6, 0.6))));
+    s.world.add(make_shared<sphere>(point3(0,0,-1),      0.5, make_shared<lambertian>(color(0.7, 0.2, 0.1))));
+    s.world.add(make_shared<sphere>(point3(1,0,-1),      0.5, make_shared<dielectric>(1.5)));
+    s.world.add(make_shared<sphere>(point3(-0.6,1.2,-0.4), 0.15, make_shared<diffuse_light>(light_color)));
+    s.lights.add(make_shared<sphere_light>(point3(-0.6,1.2,-0.4), 0.15, light_color));
+    s.cam.vfov     = 40;
+    s.cam.lookfrom = point3(0, 0.5, 2);
+    s.cam.lookat   = point3(0, 0, -1);
+    return s;
+}
+
+struct bench_config {
+    std::map<std::string, std::string> settings;
+
+    double number(const std::string& key, double fallback) const {
+        auto it = settings.find(key);
+        return it == settings.end() ? fallback : std::atof(it->second.c_str());
+    }
+
+    std::string text(const std::string& key, const std::string& fallback) const {
+        auto it = settings.find(key);
+        return it == settings.end() ? fallback : it->second;
+    }
+
+    // Camera fields under test, as a short label for the CSV.
+    std::string label() const {
+        std::string out;
+        for (const auto& kv : settings) {
+            if (kv.first == "scene" || kv.first == "budgets" || kv.first == "references" || kv.first == "ref_spp") continue;
+            out += (out.empty() ? "" : ";") + kv.first + "=" + kv.second;
+        }
+        return out.empty() ? "default" : out;
+    }
+};
+
+void setup_camera(camera& cam, int width, int max_depth) {
+    cam.aspect_ratio  = 16.0 / 9.0;
+    cam.image_width   = width;
+    cam.max_depth     = max_depth;
+    cam.show_progress = false;
+}
+
+// Reference image for a scene, rendered once and cached on disk.
+std::vector<color> reference_image(bench_scene& s, const std::string& cache_dir, int width, int ref_spp) {
+    std::ostringstream path;
+    // everything the reference depends on is in its name, a stale one is never picked up.
+    path << cache_dir << '/' << s.name << "_v" << s.version << "_r" << renderer_version << '_' << width << "w_"
+         << ref_spp << "spp_" << reference_depth << "d.pfm";
+
+    int w, h;
+    std::vector<color> reference;
+    if (read_pfm(path.str(), w, h, reference) && w == width) {
+        return reference;
+    }
+
+    std::clog << "Rendering reference " << path.str() << " ..." << std::endl;
+    camera cam = s.cam;
+    setup_camera(cam, width, reference_depth);
+    cam.samples_per_pixel = ref_spp;
+
+    color_buffer frame;
+    cam.render_frame(s.world, s.lights, frame);
+    reference.assign(frame.begin(), frame.end());
+
+    mkdir(cache_dir.c_str(), 0755);
+    write_pfm(path.str(), width, int(reference.size() / width), reference);
+    return reference;
+}
+
+void image_error(const std::vector<color>& image, const std::vector<color>& reference, double& rmse, double& relmse) {
+    double se = 0, rel = 0;
+    for (size_t k = 0; k < image.size(); ++k) {
+        for (int c = 0; c < 3; ++c) {
+            auto d = image[k][c] - reference[k][c];
+            se  += d * d;
+            rel += d * d / (reference[k][c] * reference[k][c] + 0.01);
+        }
+    }
+    auto n = 3.0 * image.size();
+    rmse = sqrt(se / n);
+    relmse = rel / n;
+}
+
+void run_benchmark(bench_scene& s, const bench_config& config, const std::vector<double>& budgets) {
+    const int width    = static_cast<int>(config.number("width", 400));
+    const int ref_spp  = static_cast<int>(config.number("ref_spp", 4096));
+    const int pass_spp = std::max(1, static_cast<int>(config.number("pass_spp", 1)));
+    const bool denoise = config.number("denoise", 0) != 0;
+
+    auto reference = reference_image(s, config.text("references", "bench_cache"), width, ref_spp);
+
+    camera cam = s.cam;
+    setup_camera(cam, width, static_cast<int>(config.number("max_depth", 50)));
+    cam.samples_per_pixel = pass_spp;
+    cam.defocus_angle     = config.number("defocus_angle", cam.defocus_angle);
+    cam.block_size        = static_cast<int>(config.number("block_size", cam.block_size));
+    cam.write_aovs        = denoise;
+    if (config.number("cache", 0) != 0) {
+        cam.cache        = make_shared<radiance_cache>();
+        cam.cache_bounce = static_cast<int>(config.number("cache_bounce", cam.cache_bounce));
+    }
+
+    light_list no_lights;
+    const light_list& lights = config.number("lights", 1) != 0 ? s.lights : no_lights;
+
+    const double max_budget = *std::max_element(budgets.begin(), budgets.end());
+    std::vector<color> accum(reference.size(), color(0,0,0)), estimate(reference.size());
+    color_buffer frame;
+    thread_pool denoise_pool(std::max(1u, std::thread::hardware_concurrency()));
+    size_t next_budget = 0;
+    int passes = 0;
+    double rmse = 0, relmse = 0, elapsed = 0;
+
+    while (true) {
+        // rendering, accumulation and the denoise of the current estimate count towards the
+        // budget, not the error measurement. Only the latest denoise is charged: a real render
+        // would filter once, at the end.
+        auto pass_start = std::chrono::steady_clock::now();
+        cam.render_frame(s.world, lights, frame);
+        passes++;
+
+        for (size_t k = 0; k < accum.size(); ++k) {
+            accum[k] += frame[k];
+        }
+        elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - pass_start).count();
+
+        for (size_t k = 0; k < accum.size(); ++k) {
+            estimate[k] = accum[k] / passes;
+        }
+        double denoise_seconds = 0;
+        if (denoise) {
+            auto denoise_start = std::chrono::steady_clock::now();
+            // the last pass's variance, scaled down to the accumulated estimate.
+            aov_buffers aovs = cam.aovs;
+            for (auto& v : aovs.variance) v /= passes;
+            color_buffer filtered(estimate.begin(), estimate.end());
+            atrous_denoise(filtered, width, int(estimate.size() / width), aovs, denoise_pool, cam.denoiser);
+            estimate.assign(filtered.begin(), filtered.end());
+            denoise_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - denoise_start).count();
+        }
+        const double seconds = elapsed + denoise_seconds;
+        image_error(estimate, reference, rmse, relmse);
+
+        std::cout << s.name << ',' << config.label() << ',' << passes << ',' << seconds << ','
+                  << passes * pass_spp << ',' << rmse << ',' << relmse << std::endl;
+
+        while (next_budget < budgets.size() && seconds >= budgets[next_budget]) {
+            std::cout << s.name << ',' << config.label() << ",budget," << budgets[next_budget] << ','
+                      << passes * pass_spp << ',' << rmse << ',' << relmse << std::endl;
+            next_budget++;
+        }
+        if (seconds >= max_budget) break;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bench_config config;
+    for (int a = 1; a < argc; ++a) {
+        const char* eq = std::strchr(argv[a], '=');
+        if (!eq) {
+            std::cerr << "ignoring argument without '=': " << argv[a] << std::endl;
+            continue;
+        }
+        config.settings[std::string(argv[a], eq - argv[a])] = eq + 1;
+    }
+
+    std::vector<double> budgets;
+    std::stringstream list(config.text("budgets", "1,10,60"));
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        if (!item.empty()) budgets.push_back(std::atof(item.c_str()));
+    }
+    std::sort(budgets.begin(), budgets.end());
+    if (budgets.empty()) budgets.push_back(1);
+
+    std::vector<bench_scene> scenes;
+    auto which = config.text("scene", "all");
+    if (which == "all" || which == "spheres") scenes.push_back(spheres_scene());
+    if (which == "all" || which == "random")  scenes.push_back(random_scene());
+    if (which == "all" || which == "lit")     scenes.push_back(lit_scene());
+
+    std::cout << "scene,config,pass,seconds,spp,rmse,relmse" << std::endl;
+    for (auto& s : scenes) {
+        s.world = hittable_list(make_shared<bvh8>(s.world));
+        run_benchmark(s, config, budgets);
+    }
+    return 0;
+}
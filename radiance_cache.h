@@ -0,0 +1,145 @@
+#ifndef RADIANCE_CACHE_H
+#define RADIANCE_CACHE_H
+
+#include "color.h"
+#include "mlem.h"
+#include "vec3.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+// World-space cache of the radiance reflected by diffuse surfaces, on a hashed grid.
+// Cells are keyed by the quantized position and the dominant axis of the normal, so the
+// two sides of a thin object don't mix, and live in a fixed open-addressed table.
+// Threads add samples and read means concurrently without locks: a cell is claimed with
+// a compare-exchange on its key, and sums are updated with atomics. Once a cell has
+// max_samples it stops taking new ones, which keeps hot cells from being contended.
+// Cells grow with distance from the viewpoint (power of two steps, the level is part of
+// the key), so a cell covers about the same few pixels near and far.
+// Cell size trades bias (blur across a cell) against how fast cells converge.
+class radiance_cache {
+    public:
+        double cell_size;     // world units per unit of distance from the viewpoint
+        int    min_samples;   // a cell answers lookups from this many samples on
+        int    max_samples;   // and stops accumulating at this many
+        double max_sample;    // luminance clamp, so a firefly can't poison a cell
+
+        radiance_cache(double cell = 0.01, size_t capacity = size_t(1) << 20, int min_count = 16,
+                       int max_count = 1024, double clamp = 10)
+          : cell_size(cell), min_samples(min_count), max_samples(max_count), max_sample(clamp),
+            mask(round_up_pow2(capacity) - 1), cells(new cell_entry[mask + 1]) {}
+
+        size_t capacity() const { return mask + 1; }
+
+        // Cells are sized by distance from here, the camera sets it before each frame.
+        void set_viewpoint(const point3& p) { viewpoint = p; }
+
+        // Mean reflected radiance of the cell around p, false while it has too few samples.
+        // The query point is jittered by up to half a cell, so cell borders turn into noise
+        // instead of visible blocks.
+        bool lookup(const point3& p, const vec3& n, color& radiance) const {
+            point3 q = p + (0.5 * size_at(p)) * vec3(random_double(-1,1), random_double(-1,1), random_double(-1,1));
+            const cell_entry* c = find(key(q, n), false);
+            if (!c) return false;
+            auto count = c->count.load(std::memory_order_acquire);
+            if (count < static_cast<uint32_t>(min_samples)) return false;
+            radiance = color(c->sum[0].load(std::memory_order_relaxed),
+                             c->sum[1].load(std::memory_order_relaxed),
+                             c->sum[2].load(std::memory_order_relaxed)) / count;
+            return true;
+        }
+
+        void add(const point3& p, const vec3& n, color radiance) {
+            cell_entry* c = const_cast<cell_entry*>(find(key(p, n), true));
+            if (!c || c->count.load(std::memory_order_relaxed) >= static_cast<uint32_t>(max_samples)) {
+                return;
+            }
+            auto lum = luminance(radiance);
+            if (!(lum >= 0)) return;  // NaN or negative
+            if (lum > max_sample) radiance *= max_sample / lum;
+            for (int k = 0; k < 3; ++k) {
+                atomic_add(c->sum[k], static_cast<float>(radiance[k]));
+            }
+            c->count.fetch_add(1, std::memory_order_release);
+        }
+
+        // Drops everything, not safe while a render is using the cache.
+        void clear() {
+            for (size_t i = 0; i <= mask; ++i) {
+                cells[i].key.store(0, std::memory_order_relaxed);
+                cells[i].count.store(0, std::memory_order_relaxed);
+                for (int k = 0; k < 3; ++k) cells[i].sum[k].store(0, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        struct cell_entry {
+            std::atomic<uint64_t> key{0};     // 0: free
+            std::atomic<uint32_t> count{0};
+            std::atomic<float>    sum[3];
+            cell_entry() { for (auto& s : sum) s.store(0, std::memory_order_relaxed); }
+        };
+
+        static const int max_probe = 16;
+
+        size_t mask;
+        std::unique_ptr<cell_entry[]> cells;
+        point3 viewpoint;
+
+        static size_t round_up_pow2(size_t n) {
+            size_t p = 1;
+            while (p < n) p <<= 1;
+            return p;
+        }
+
+        static void atomic_add(std::atomic<float>& a, float v) {
+            float old = a.load(std::memory_order_relaxed);
+            while (!a.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {}
+        }
+
+        static uint64_t mix(uint64_t h) {
+            // splitmix64 finalizer.
+            h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+            h ^= h >> 27; h *= 0x94d049bb133111ebull;
+            return h ^ (h >> 31);
+        }
+
+        int level_at(const point3& p) const {
+            return static_cast<int>(std::ceil(std::log2(cell_size * fmax(1e-3, (p - viewpoint).length()))));
+        }
+
+        double size_at(const point3& p) const { return std::ldexp(1.0, level_at(p)); }
+
+        uint64_t key(const point3& p, const vec3& n) const {
+            auto ax = fabs(n.x()), ay = fabs(n.y()), az = fabs(n.z());
+            int axis = (ax > ay && ax > az) ? 0 : (ay > az ? 1 : 2);
+            uint64_t face = 2 * axis + (n[axis] < 0);
+            int level = level_at(p);
+            double size = std::ldexp(1.0, level);
+            uint64_t h = mix(face + 8 * static_cast<uint64_t>(level + 1024));
+            for (int a = 0; a < 3; ++a) {
+                auto cell = static_cast<int64_t>(std::floor(p[a] / size));
+                h = mix(h * 0x9e3779b97f4a7c15ull + static_cast<uint64_t>(cell));
+            }
+            return h | 1;  // never 0, which marks a free slot
+        }
+
+        const cell_entry* find(uint64_t k, bool insert) const {
+            size_t i = k & mask;
+            for (int probe = 0; probe < max_probe; ++probe, i = (i + 1) & mask) {
+                uint64_t current = cells[i].key.load(std::memory_order_acquire);
+                if (current == k) return &cells[i];
+                if (current == 0) {
+                    if (!insert) return nullptr;
+                    if (cells[i].key.compare_exchange_strong(current, k, std::memory_order_acq_rel) || current == k) {
+                        return &cells[i];
+                    }
+                }
+            }
+            return nullptr;  // table full around here, the caller just traces
+        }
+};
+
+#endif
@@ -0,0 +1,100 @@
+// Raster pre-pass check: camera::raster_primary has to find the same first hits as tracing
+// the camera rays. Jitter makes frames differ anyway, so pixels whose first-hit features
+// (albedo and inverse depth, 0 where nothing was hit) differ noticeably between a raster
+// and a traced frame are counted, against the same count for two traced frames. Those
+// outliers are edge pixels; a primitive missing from a block's bin, or a wrong nearest hit,
+// adds whole runs of them.
+//
+// Usage: ./raster_check       prints the outlier counts and timings, exits 1 on a mismatch
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include "hittable_list.h"
+#include "camera.h"
+#include "bvh8.h"
+#include "instance.h"
+#include "material.h"
+#include "sphere.h"
+#include "vec3.h"
+
+using std::make_shared;
+
+struct frame {
+    std::vector<color> albedo;
+    std::vector<double> inverse_depth;
+    double seconds = 0;
+};
+
+frame render(const hittable& world, bool raster) {
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 160;
+    cam.samples_per_pixel = 64;
+    cam.max_depth = 1;        // only the first hits matter here.
+    cam.vfov = 30;
+    cam.lookfrom = point3(6, 2, 8);
+    cam.lookat = point3(0, 0.3, 0);
+    cam.block_size = 32;
+    cam.show_progress = false;
+    cam.write_aovs = true;
+    cam.raster_primary = raster;
+
+    frame f;
+    color_buffer pixels;
+    auto start = std::chrono::steady_clock::now();
+    cam.render_frame(world, light_list(), pixels);
+    f.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (double d : cam.aovs.depth) {
+        f.inverse_depth.push_back(std::isfinite(d) && d > 0 ? 1 / d : 0);
+    }
+    f.albedo = cam.aovs.albedo;
+    return f;
+}
+
+int outliers(const frame& a, const frame& b) {
+    int count = 0;
+    for (size_t k = 0; k < a.albedo.size(); ++k) {
+        vec3 d = a.albedo[k] - b.albedo[k];
+        double albedo_d = std::fabs(d.x()) + std::fabs(d.y()) + std::fabs(d.z());
+        double depth_d = std::fabs(a.inverse_depth[k] - b.inverse_depth[k])
+                       / std::fmax(1e-3, std::fmax(a.inverse_depth[k], b.inverse_depth[k]));
+        count += albedo_d > 0.1 || depth_d > 0.05;
+    }
+    return count;
+}
+
+int main() {
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<double> u(-3, 3);
+
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    auto shared_ball = make_shared<sphere>(point3(0, 0.4, 0), 0.4, make_shared<metal>(color(0.8, 0.8, 0.9), 0.1));
+    for (int k = 0; k < 150; ++k) {
+        point3 c(u(rng), 0.2, u(rng));
+        if (k % 10 == 0) {
+            // instances go through moving_instance::intersect/fill_hit_record.
+            world.add(make_shared<moving_instance>(shared_ball, c - point3(0, 0.4, 0)));
+        } else {
+            auto mat = k % 3 == 0 ? shared_ptr<material>(make_shared<dielectric>(1.5))
+                                  : shared_ptr<material>(make_shared<lambertian>(color(0.2, 0.5 + 0.003 * k, 0.8)));
+            world.add(make_shared<sphere>(c, 0.2, mat));
+        }
+    }
+    world = hittable_list(make_shared<bvh8>(world));
+
+    frame traced = render(world, false);
+    frame traced_again = render(world, false);
+    frame rastered = render(world, true);
+
+    int noise = outliers(traced, traced_again);
+    int found = outliers(traced, rastered);
+
+    // allow a quarter over the noise floor.
+    bool ok = found <= 1.25 * noise + 10;
+    std::printf("%zu pixels  outliers trace/trace %d  trace/raster %d\n", traced.albedo.size(), noise, found);
+    std::printf("time   trace %.3fs  raster %.3fs%s\n", traced.seconds, rastered.seconds, ok ? "" : "  FAIL");
+    return ok ? 0 : 1;
+}
@@ -7,19 +7,33 @@ class ray{
     public:
         point3 orig;
         vec3 dir;
+        double tm = 0;  // time inside the shutter interval, for motion blur
+        // ray cone, a cheap isotropic ray differential: footprint width at the origin and
+        // its growth per unit distance. Picks texture mip levels; 0 means a point sample.
+        double cone_width = 0;
+        double cone_angle = 0;
 
     public:
         ray() {}
         ray(const point3& origin, const vec3& direction)
             : orig(origin), dir(direction) 
             {}
+        ray(const point3& origin, const vec3& direction, double time)
+            : orig(origin), dir(direction), tm(time)
+            {}
 
         point3 origin() const { return orig; }
         vec3 direction() const { return dir; }
+        double time() const { return tm; }
 
         point3 at(double t) const {
             return orig + t*dir;
         }
+
+        // width of the ray cone at parameter t.
+        double footprint(double t) const {
+            return cone_width + cone_angle * t * dir.length();
+        }
 };
 
 
@@ -0,0 +1,125 @@
+#ifndef RENDER_JOB_H
+#define RENDER_JOB_H
+
+#include "hittable.h"
+#include "camera.h"
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+// A finished tile as linear float RGB. It points into the job's image, no copy is made:
+// pixel (x + i, y + j) is rgb[j * stride + 3 * i ...], and it stays valid while the job lives.
+struct tile_view {
+    int x, y, width, height;
+    size_t stride;      // floats per row
+    const float* rgb;
+};
+
+// Asynchronous render for embedding: start() returns at once with a handle, the frame is
+// rendered tile by tile on the camera's worker threads, and nothing is written to stdout.
+// Every finished tile is passed to the optional handler, called from the render thread that
+// made it, so tiles can be composited or encoded while the rest still renders. The handler
+// must be thread safe and must not throw.
+class render_job {
+    public:
+        using tile_handler = std::function<void(const tile_view&)>;
+
+        static shared_ptr<render_job> start(const camera& cam, shared_ptr<const hittable> world,
+                                            shared_ptr<const light_list> lights,
+                                            tile_handler on_tile = tile_handler(), int tile_size = 64) {
+            shared_ptr<render_job> job(new render_job(cam, world, lights, on_tile, tile_size));
+            render_job* self = job.get();
+            job->finished = std::async(std::launch::async, [self] { return self->run(); }).share();
+            return job;
+        }
+
+        // Cancels and waits, the job's threads never outlive it.
+        ~render_job() {
+            cancel();
+            wait();
+        }
+
+        render_job(const render_job&) = delete;
+        render_job& operator=(const render_job&) = delete;
+
+        // Fraction of tiles finished, in [0, 1].
+        double progress() const {
+            return tile_count ? double(tiles_done.load()) / tile_count : 1.0;
+        }
+
+        // Tiles already rendering finish, the rest are skipped.
+        void cancel() { cancel_flag = true; }
+
+        bool cancelled() const { return cancel_flag; }
+
+        bool done() const {
+            return finished.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }
+
+        // Blocks until the render ends. True if it completed, false if it was cancelled.
+        bool wait() const { return finished.get(); }
+
+        int width() const { return image_width; }
+        int height() const { return image_height; }
+
+        // The whole frame, width() * height() * 3 floats. Complete after wait() returns true.
+        const float* image() const { return pixels.data(); }
+
+    private:
+        camera cam;
+        shared_ptr<const hittable> world;
+        shared_ptr<const light_list> lights;
+        tile_handler on_tile;
+        int tile_size;
+
+        int image_width, image_height, tile_count;
+        std::vector<float> pixels;
+        std::atomic<int> tiles_done{0};
+        std::atomic<bool> cancel_flag{false};
+        std::shared_future<bool> finished;
+
+        render_job(const camera& c, shared_ptr<const hittable> w, shared_ptr<const light_list> l,
+                   tile_handler handler, int tile)
+          : cam(c), world(w), lights(l), on_tile(handler), tile_size(std::max(1, tile))
+        {
+            cam.separate_workers();
+            cam.show_progress = false;
+            if (cam.cache) {
+                // a cache of its own: each frame moves the cache's viewpoint, which would shift
+                // the cells under any other render sharing it.
+                const radiance_cache& shared = *cam.cache;
+                cam.cache = make_shared<radiance_cache>(shared.cell_size, shared.capacity(), shared.min_samples,
+                                                        shared.max_samples, shared.max_sample);
+            }
+            image_width = cam.image_width;
+            image_height = cam.output_height();
+            tile_count = ((image_width + tile_size - 1) / tile_size) * ((image_height + tile_size - 1) / tile_size);
+            pixels.resize(size_t(image_width) * image_height * 3);
+        }
+
+        bool run() {
+            const size_t stride = size_t(image_width) * 3;
+            return cam.render_tiles(*world, *lights, tile_size,
+                [&](int x0, int y0, int w, int h, const color* tile, int tile_stride) {
+                    float* out = &pixels[y0 * stride + size_t(x0) * 3];
+                    for (int y = 0; y < h; ++y) {
+                        for (int x = 0; x < w; ++x) {
+                            const color& c = tile[y * tile_stride + x];
+                            float* px = out + y * stride + 3 * x;
+                            px[0] = static_cast<float>(c.x());
+                            px[1] = static_cast<float>(c.y());
+                            px[2] = static_cast<float>(c.z());
+                        }
+                    }
+                    if (on_tile) {
+                        on_tile(tile_view{x0, y0, w, h, stride, out});
+                    }
+                    ++tiles_done;
+                }, &cancel_flag);
+        }
+};
+
+#endif
@@ -0,0 +1,156 @@
+// render_job check: a job has to report its progress, hand every tile to the handler
+// exactly once, keep the tile views valid after wait(), stop early when cancelled (also
+// from its destructor), leave the caller's radiance cache alone, and never write to stdout.
+//
+// Usage: ./render_job_check   prints a line per case, exits 1 on any failure
+//
+// stdout is redirected to a temporary file while the jobs run, so the report itself goes
+// to stderr.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "radiance_cache.h"
+#include "render_job.h"
+#include "sphere.h"
+
+using std::make_shared;
+
+camera test_camera(int width, int spp) {
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = width;
+    cam.samples_per_pixel = spp;
+    cam.max_depth = 8;
+    cam.lookfrom = point3(0, 0.5, 2);
+    cam.lookat = point3(0, 0, -1);
+    cam.vfov = 40;
+    return cam;
+}
+
+bool check_complete(shared_ptr<const hittable> world, shared_ptr<const light_list> lights) {
+    camera cam = test_camera(150, 4);
+    cam.cache = make_shared<radiance_cache>(0.2);  // coarse, so cells fill up in one small frame
+
+    std::mutex lock;
+    std::vector<tile_view> views;
+    auto job = render_job::start(cam, world, lights, [&](const tile_view& t) {
+        std::lock_guard<std::mutex> guard(lock);
+        views.push_back(t);
+    }, 32);
+
+    // progress only grows and stays in [0, 1].
+    bool progress_ok = true;
+    double last = 0;
+    while (!job->done()) {
+        double p = job->progress();
+        progress_ok = progress_ok && p >= last && p <= 1;
+        last = p;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    bool completed = job->wait() && job->wait();  // a second wait() returns the same
+    progress_ok = progress_ok && job->progress() == 1;
+
+    // every pixel in exactly one tile, and the views still show the finished image.
+    const int w = job->width(), h = job->height();
+    std::vector<int> covered(size_t(w) * h, 0);
+    bool views_ok = true;
+    for (const auto& t : views) {
+        for (int y = 0; y < t.height; ++y) {
+            for (int x = 0; x < t.width; ++x) {
+                size_t k = size_t(t.y + y) * w + (t.x + x);
+                covered[k]++;
+                for (int c = 0; c < 3; ++c) {
+                    views_ok = views_ok && t.rgb[y * t.stride + 3 * x + c] == job->image()[3 * k + c];
+                }
+            }
+        }
+    }
+    int bad_coverage = 0;
+    for (int c : covered) bad_coverage += c != 1;
+
+    // the job renders with its own cache, so the caller's never saw a sample.
+    int cached = 0;
+    cam.cache->set_viewpoint(cam.lookfrom);
+    for (int k = 0; k < 1000; ++k) {
+        // points on the ground sphere in front of the camera.
+        double x = random_double(-1.5, 1.5), z = random_double(-3, 0);
+        point3 p(x, -100.5 + std::sqrt(100 * 100 - x * x - (z + 1) * (z + 1)), z);
+        color got;
+        cached += cam.cache->lookup(p, unit_vector(p - point3(0, -100.5, -1)), got);
+    }
+
+    bool ok = completed && progress_ok && views_ok && bad_coverage == 0 && cached == 0;
+    std::fprintf(stderr, "complete   %zu tiles  progress %s  views %s  %d pixels not in one tile  %d cache hits%s\n",
+                 views.size(), progress_ok ? "ok" : "wrong", views_ok ? "ok" : "stale", bad_coverage, cached,
+                 ok ? "" : "  FAIL");
+    return ok;
+}
+
+bool check_cancel(shared_ptr<const hittable> world, shared_ptr<const light_list> lights) {
+    // far more work than the test waits for.
+    camera cam = test_camera(1200, 256);
+    auto job = render_job::start(cam, world, lights, render_job::tile_handler(), 16);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto start = std::chrono::steady_clock::now();
+    job->cancel();
+    bool completed = job->wait();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool ok = !completed && job->cancelled() && job->progress() < 1 && seconds < 5;
+    std::fprintf(stderr, "cancel     stopped at %.1f%% in %.3fs%s\n", 100 * job->progress(), seconds, ok ? "" : "  FAIL");
+    return ok;
+}
+
+bool check_destroy(shared_ptr<const hittable> world, shared_ptr<const light_list> lights) {
+    // dropping the last handle while tiles are rendering cancels and joins.
+    camera cam = test_camera(1200, 256);
+    std::atomic<int> tiles{0};
+    auto start = std::chrono::steady_clock::now();
+    {
+        auto job = render_job::start(cam, world, lights, [&](const tile_view&) { ++tiles; }, 16);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int after = tiles;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    bool ok = seconds < 5 && tiles == after;  // no handler calls once the destructor returned
+    std::fprintf(stderr, "destroy    returned in %.3fs after %d tiles%s\n", seconds, after, ok ? "" : "  FAIL");
+    return ok;
+}
+
+int main() {
+    auto scene = make_shared<hittable_list>();
+    scene->add(make_shared<sphere>(point3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.8, 0.8, 0.8))));
+    scene->add(make_shared<sphere>(point3(0, 0, -1), 0.5, make_shared<lambertian>(color(0.7, 0.3, 0.3))));
+    scene->add(make_shared<sphere>(point3(1, 0, -1), 0.5, make_shared<dielectric>(1.5)));
+    shared_ptr<const hittable> world = scene;
+    auto lights = make_shared<const light_list>();
+
+    std::fflush(stdout);
+    char path[] = "/tmp/render_job_check_XXXXXX";
+    int capture = mkstemp(path);
+    int saved = dup(1);
+    dup2(capture, 1);
+
+    int failures = 0;
+    failures += !check_complete(world, lights);
+    failures += !check_cancel(world, lights);
+    failures += !check_destroy(world, lights);
+
+    std::cout << std::flush;
+    std::fflush(stdout);
+    dup2(saved, 1);
+    off_t written = lseek(capture, 0, SEEK_END);
+    close(capture);
+    std::remove(path);
+    std::fprintf(stderr, "stdout     %lld bytes written%s\n", static_cast<long long>(written), written == 0 ? "" : "  FAIL");
+    failures += written != 0;
+    return failures == 0 ? 0 : 1;
+}
@@ -8,22 +8,82 @@
 #include "vec3.h"
 #include <functional>
 #include <memory>
+#include <vector>
 
 class sphere : public hittable {
     private:
         point3 center;
         double radius;
         shared_ptr<material> mat;
+        std::vector<point3> keys;   // center keyframes spread evenly over [0,1], empty if static
+        aabb bbox;
+
+        point3 center_at(double time) const {
+            // static spheres skip the keyframe lookup entirely.
+            if (keys.empty()) {
+                return center;
+            }
+            auto x = interval(0, 1).clamp(time) * (keys.size() - 1);
+            auto k = std::min(static_cast<size_t>(x), keys.size() - 2);
+            auto f = x - k;
+            return (1 - f) * keys[k] + f * keys[k+1];
+        }
+
+        static void get_sphere_uv(const vec3& p, double& u, double& v) {
+            // p: a point on the unit sphere. u runs around the y axis from -x,
+            // v from the south pole (0) to the north pole (1).
+            auto theta = std::acos(-p.y());
+            auto phi = std::atan2(-p.z(), p.x()) + M_PI;
+            u = phi / (2 * M_PI);
+            v = theta / M_PI;
+        }
 
     public:
         sphere() {}
-        sphere(point3 cen, double r, shared_ptr<material> m) : center(cen), radius(r), mat(m) {};
+        sphere(point3 cen, double r, shared_ptr<material> m) : center(cen), radius(r), mat(m) {
+            auto rvec = vec3(radius, radius, radius);
+            bbox = aabb(center - rvec, center + rvec);
+        };
+
+        // Sphere moving linearly from cen0 at time 0 to cen1 at time 1.
+        sphere(point3 cen0, point3 cen1, double r, shared_ptr<material> m)
+            : sphere(std::vector<point3>{cen0, cen1}, r, m) {}
+
+        // Sphere following the piecewise linear path through 'centers' over [0,1].
+        sphere(const std::vector<point3>& centers, double r, shared_ptr<material> m)
+            : center(centers.front()), radius(r), mat(m) {
+            if (centers.size() > 1) {
+                keys = centers;
+            }
+            // the swept volume of each linear segment is inside the box of its end spheres.
+            auto rvec = vec3(radius, radius, radius);
+            for (const auto& c : centers) {
+                bbox = aabb(bbox, aabb(c - rvec, c + rvec));
+            }
+        }
 
         bool hit (const ray& r, interval ray_t, hit_record& rec) const override;
+        bool occluded(const ray& r, interval ray_t) const override;
+        bool intersect(const ray& r, interval ray_t, double& t, const hittable*& prim) const override;
+        void fill_hit_record(const ray& r, double t, hit_record& rec) const override;
+
+        aabb bounding_box() const override { return bbox; }
+
+        bool is_moving() const override { return !keys.empty(); }
 };
 
 bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
-    vec3 oc = r.origin() - center;
+    double t;
+    const hittable* prim;
+    if (!intersect(r, ray_t, t, prim)) {
+        return false;
+    }
+    fill_hit_record(r, t, rec);
+    return true;
+}
+
+bool sphere::intersect(const ray& r, interval ray_t, double& t, const hittable*& prim) const {
+    vec3 oc = r.origin() - center_at(r.time());
     auto a = dot(r.direction(), r.direction());
     auto half_b = dot(oc, r.direction());
     auto c = dot(oc, oc) - radius * radius;
@@ -44,14 +104,37 @@ bool sphere::hit(const ray& r, interval ray_t, hit_record& rec) const {
         }
     }
 
-    rec.t = root;
+    t = root;
+    prim = this;
+    return true;
+}
+
+void sphere::fill_hit_record(const ray& r, double t, hit_record& rec) const {
+    rec.t = t;
     rec.p = r.at(rec.t);
-    vec3 outward_normal = (rec.p - center) / radius;
+    vec3 outward_normal = (rec.p - center_at(r.time())) / radius;
     rec.set_face_normal(r, outward_normal);
+    get_sphere_uv(outward_normal, rec.u, rec.v);
+    // v covers half a great circle (pi r), u a whole one at the equator: filter for the faster v.
+    rec.uv_per_unit = 1 / (M_PI * std::fabs(radius));
 
     rec.mat = mat;
+}
 
-    return true;
+bool sphere::occluded(const ray& r, interval ray_t) const {
+    // same root test as hit(), without building the hit record.
+    vec3 oc = r.origin() - center_at(r.time());
+    auto a = dot(r.direction(), r.direction());
+    auto half_b = dot(oc, r.direction());
+    auto c = dot(oc, oc) - radius * radius;
+    auto discriminant = half_b * half_b - a*c;
+
+    if (discriminant < 0) {
+        return false;
+    }
+
+    auto sqrtd = sqrt(discriminant);
+    return ray_t.surrounds((-half_b - sqrtd) / a) || ray_t.surrounds((-half_b + sqrtd) / a);
 }
 
 #endif // !SPHERE_H
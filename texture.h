@@ -0,0 +1,60 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "hittable.h"
+#include "ray.h"
+#include "texture_cache.h"
+#include "vec3.h"
+
+#include <cmath>
+#include <memory>
+#include <string>
+
+// Width in uv units of the ray's footprint at the hit, stretched at grazing angles.
+inline double uv_footprint(const ray& r, const hit_record& rec) {
+    auto cos_theta = std::fabs(dot(unit_vector(r.direction()), rec.normal));
+    return r.footprint(rec.t) * rec.uv_per_unit / std::fmax(cos_theta, 0.1);
+}
+
+class texture {
+    public:
+        virtual ~texture() = default;
+
+        // 'footprint' is the filter width in uv units, see uv_footprint().
+        virtual color value(double u, double v, double footprint) const = 0;
+};
+
+class solid_color : public texture {
+    private:
+        color albedo;
+    public:
+        solid_color(const color& c) : albedo(c) {}
+
+        color value(double u, double v, double footprint) const override { return albedo; }
+};
+
+// An image in a shared texture_cache, so many textures share one memory budget.
+class image_texture : public texture {
+    private:
+        shared_ptr<texture_cache> cache;
+        int id;
+        color scale;
+
+        image_texture(shared_ptr<texture_cache> c, int texture_id, const color& s)
+          : cache(c), id(texture_id), scale(s) {}
+
+    public:
+        // Returns nullptr if 'path' isn't a readable RGB PFM.
+        static shared_ptr<image_texture> load(shared_ptr<texture_cache> cache, const std::string& path,
+                                              const color& scale = color(1,1,1)) {
+            int texture_id = cache->open(path);
+            if (texture_id < 0) return nullptr;
+            return shared_ptr<image_texture>(new image_texture(cache, texture_id, scale));
+        }
+
+        color value(double u, double v, double footprint) const override {
+            return scale * cache->lookup(id, u, v, footprint);
+        }
+};
+
+#endif
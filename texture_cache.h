@@ -0,0 +1,434 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "pfm.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Shared store for image textures much larger than memory. Each texture is an RGB PFM;
+// its mip pyramid (box filtered by area, halving down to one texel) is built once, streaming, into a
+// "<file>.mip" sidecar next to it, and reused while the sidecar is newer than the image.
+// Level 0 is read straight from the PFM. Texels are only ever read a tile at a time
+// with positional reads, so nothing but the resident tiles is held in memory.
+// Resident tiles live in an LRU cache split into shards with a lock each, and the least
+// recently used tiles are dropped once the shard passes its part of the memory budget.
+// Each thread also keeps its last few tiles, so the texels of one filtered lookup
+// (and of neighbouring pixels) don't touch the shared locks at all.
+// open() is not thread safe, call it while building the scene; lookup() is.
+class texture_cache {
+    public:
+        // budget: bytes of tile data kept resident, tile_size: tile edge in texels.
+        texture_cache(size_t budget = size_t(256) << 20, int tile_size = 64)
+          : tile(std::max(8, tile_size)), shard_budget(budget / shard_count),
+            serial(next_serial()) {}
+
+        ~texture_cache() {
+            for (auto& img : images) {
+                for (int fd : img.fds) ::close(fd);
+            }
+        }
+
+        texture_cache(const texture_cache&) = delete;
+        texture_cache& operator=(const texture_cache&) = delete;
+
+        // Returns the id of the texture in 'path', or -1 if it isn't a readable RGB PFM.
+        int open(const std::string& path) {
+            image img;
+            if (!open_source(path, img) || !open_pyramid(path, img)) {
+                for (int fd : img.fds) ::close(fd);
+                return -1;
+            }
+            images.push_back(std::move(img));
+            return static_cast<int>(images.size()) - 1;
+        }
+
+        int width(int id) const { return images[id].levels[0].width; }
+        int height(int id) const { return images[id].levels[0].height; }
+        int levels(int id) const { return static_cast<int>(images[id].levels.size()); }
+
+        // Trilinear lookup at (u, v), u wrapping and v clamped, v = 0 at the bottom row.
+        // 'footprint' is the filter width in uv units (1 spans the texture's width), it
+        // picks the pair of mip levels to blend.
+        color lookup(int id, double u, double v, double footprint) const {
+            const image& img = images[id];
+            const int top = static_cast<int>(img.levels.size()) - 1;
+            auto lod = std::log2(std::max(1.0, footprint * img.levels[0].width));
+            if (!(lod < top)) {
+                return bilinear(id, top, u, v);
+            }
+            int level = static_cast<int>(lod);
+            auto f = lod - level;
+            color c = bilinear(id, level, u, v);
+            return f > 0 ? (1 - f) * c + f * bilinear(id, level + 1, u, v) : c;
+        }
+
+        size_t resident_bytes() const {
+            size_t total = 0;
+            for (auto& s : shards) {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                total += s.bytes;
+            }
+            return total;
+        }
+
+        // tiles read from disk so far, including ones read again after eviction.
+        size_t tiles_loaded() const { return loads.load(std::memory_order_relaxed); }
+
+    private:
+        struct level_info {
+            int width, height;
+            int fd;           // index into image::fds
+            uint64_t offset;  // of the bottom row, rows are width * 3 floats
+        };
+
+        struct image {
+            std::vector<int> fds;  // the PFM, then the sidecar
+            bool swap = false;     // PFM data in the other byte order (level 0 only)
+            std::vector<level_info> levels;
+        };
+
+        struct tile_data {
+            int width, height;     // smaller than the tile edge at the image borders
+            std::vector<float> rgb;
+        };
+
+        struct shard {
+            mutable std::mutex mutex;
+            std::list<std::pair<uint64_t, std::shared_ptr<const tile_data>>> lru;  // most recent first
+            std::unordered_map<uint64_t, decltype(lru)::iterator> index;
+            size_t bytes = 0;
+        };
+
+        // per thread, the last few tiles this thread used from any cache.
+        struct recent_tile {
+            uint64_t owner = 0;
+            uint64_t key = 0;
+            std::shared_ptr<const tile_data> data;
+        };
+
+        static const int shard_count = 16;
+        static const int recent_count = 8;
+        static const uint64_t sidecar_magic = 0x32504d49504d4650ull;  // "PFMPIMP2", area-weighted levels
+        static const int sidecar_header = 64;
+
+        int tile;
+        size_t shard_budget;
+        uint64_t serial;  // tells this cache apart in the per-thread tiles
+        std::vector<image> images;
+        mutable shard shards[shard_count];
+        mutable std::atomic<size_t> loads{0};
+
+        static uint64_t next_serial() {
+            static std::atomic<uint64_t> counter{0};
+            return ++counter;
+        }
+
+        static uint64_t tile_key(int id, int level, int tx, int ty) {
+            return (uint64_t(id) << 48) | (uint64_t(level) << 42) | (uint64_t(ty) << 21) | uint64_t(tx);
+        }
+
+        color bilinear(int id, int level, double u, double v) const {
+            const level_info& l = images[id].levels[level];
+            auto x = (u - std::floor(u)) * l.width - 0.5;
+            auto y = std::min(1.0, std::max(0.0, v)) * l.height - 0.5;
+            auto x0 = std::floor(x), y0 = std::floor(y);
+            auto fx = x - x0, fy = y - y0;
+            int i0 = static_cast<int>(x0), j0 = static_cast<int>(y0);
+            int i1 = i0 + 1, j1 = j0 + 1;
+            if (i0 < 0) i0 += l.width;
+            if (i1 >= l.width) i1 -= l.width;
+            j0 = std::max(j0, 0);
+            j1 = std::min(j1, l.height - 1);
+            return (1 - fy) * ((1 - fx) * texel(id, level, i0, j0) + fx * texel(id, level, i1, j0))
+                 +      fy  * ((1 - fx) * texel(id, level, i0, j1) + fx * texel(id, level, i1, j1));
+        }
+
+        color texel(int id, int level, int i, int j) const {
+            const tile_data& t = *get_tile(id, level, i / tile, j / tile);
+            const float* p = &t.rgb[3 * (size_t(j % tile) * t.width + i % tile)];
+            return color(p[0], p[1], p[2]);
+        }
+
+        const tile_data* get_tile(int id, int level, int tx, int ty) const {
+            thread_local recent_tile recent[recent_count];
+            thread_local int next_slot = 0;
+
+            const uint64_t key = tile_key(id, level, tx, ty);
+            for (auto& r : recent) {
+                if (r.key == key && r.owner == serial) return r.data.get();
+            }
+
+            auto data = fetch(key, id, level, tx, ty);
+            recent_tile& slot = recent[next_slot];
+            next_slot = (next_slot + 1) % recent_count;
+            slot.owner = serial;
+            slot.key = key;
+            slot.data = std::move(data);
+            return slot.data.get();
+        }
+
+        std::shared_ptr<const tile_data> fetch(uint64_t key, int id, int level, int tx, int ty) const {
+            shard& s = shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                auto found = s.index.find(key);
+                if (found != s.index.end()) {
+                    s.lru.splice(s.lru.begin(), s.lru, found->second);
+                    return found->second->second;
+                }
+            }
+
+            // read outside the lock; if another thread loaded it meanwhile, use theirs.
+            std::shared_ptr<const tile_data> data = load_tile(id, level, tx, ty);
+            loads.fetch_add(1, std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto found = s.index.find(key);
+            if (found != s.index.end()) {
+                s.lru.splice(s.lru.begin(), s.lru, found->second);
+                return found->second->second;
+            }
+            s.lru.emplace_front(key, data);
+            s.index[key] = s.lru.begin();
+            s.bytes += data->rgb.size() * sizeof(float);
+            while (s.bytes > shard_budget && s.lru.size() > 1) {
+                auto& victim = s.lru.back();
+                s.bytes -= victim.second->rgb.size() * sizeof(float);
+                s.index.erase(victim.first);
+                s.lru.pop_back();
+            }
+            return data;
+        }
+
+        std::shared_ptr<const tile_data> load_tile(int id, int level, int tx, int ty) const {
+            const image& img = images[id];
+            const level_info& l = img.levels[level];
+            auto t = std::make_shared<tile_data>();
+            const int x0 = tx * tile, y0 = ty * tile;
+            t->width = std::min(tile, l.width - x0);
+            t->height = std::min(tile, l.height - y0);
+            t->rgb.assign(3 * size_t(t->width) * t->height, 0.0f);
+
+            const size_t row_bytes = 3 * sizeof(float) * size_t(t->width);
+            for (int j = 0; j < t->height; ++j) {
+                float* row = &t->rgb[3 * size_t(j) * t->width];
+                uint64_t at = l.offset + 3 * sizeof(float) * (uint64_t(y0 + j) * l.width + x0);
+                if (!read_at(img.fds[l.fd], row, row_bytes, at)) {
+                    std::fill(row, row + 3 * t->width, 0.0f);  // unreadable texels show black
+                }
+            }
+            if (level == 0 && img.swap) {
+                swap_bytes(t->rgb.data(), t->rgb.size());
+            }
+            return t;
+        }
+
+        static bool read_at(int fd, void* data, size_t size, uint64_t offset) {
+            char* p = static_cast<char*>(data);
+            while (size > 0) {
+                auto n = ::pread(fd, p, size, static_cast<off_t>(offset));
+                if (n <= 0) return false;
+                p += n;
+                size -= n;
+                offset += n;
+            }
+            return true;
+        }
+
+        static bool write_at(int fd, const void* data, size_t size, uint64_t offset) {
+            const char* p = static_cast<const char*>(data);
+            while (size > 0) {
+                auto n = ::pwrite(fd, p, size, static_cast<off_t>(offset));
+                if (n <= 0) return false;
+                p += n;
+                size -= n;
+                offset += n;
+            }
+            return true;
+        }
+
+        static void swap_bytes(float* v, size_t count) {
+            for (size_t k = 0; k < count; ++k) {
+                unsigned char b[4];
+                std::memcpy(b, &v[k], 4);
+                std::swap(b[0], b[3]);
+                std::swap(b[1], b[2]);
+                std::memcpy(&v[k], b, 4);
+            }
+        }
+
+        // Reads the PFM header and lays out the mip chain, level 0 in the PFM itself.
+        bool open_source(const std::string& path, image& img) const {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) return false;
+            std::string magic;
+            double scale;
+            int w, h;
+            in >> magic >> w >> h >> scale;
+            in.get(); // single whitespace before the data.
+            if (!in || magic != "PF" || w <= 0 || h <= 0) return false;
+
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            img.fds.push_back(fd);
+            img.swap = (scale < 0) != host_is_little_endian();
+            img.levels.push_back(level_info{w, h, 0, static_cast<uint64_t>(in.tellg())});
+
+            uint64_t offset = sidecar_header;
+            while (w > 1 || h > 1) {
+                w = (w + 1) / 2;
+                h = (h + 1) / 2;
+                img.levels.push_back(level_info{w, h, 1, offset});
+                offset += 3 * sizeof(float) * uint64_t(w) * h;
+            }
+            return true;
+        }
+
+        // Opens the sidecar holding levels 1 and up, building it first if it's missing or
+        // stale. Falls back to an unnamed temporary file where the sidecar can't be written.
+        bool open_pyramid(const std::string& path, image& img) const {
+            if (img.levels.size() == 1) {
+                img.fds.push_back(-1);
+                return true;
+            }
+
+            const std::string mip_path = path + ".mip";
+            struct stat source, mip;
+            if (::stat(path.c_str(), &source) == 0 && ::stat(mip_path.c_str(), &mip) == 0
+                && mip.st_mtime >= source.st_mtime) {
+                int fd = ::open(mip_path.c_str(), O_RDONLY);
+                if (fd >= 0 && sidecar_matches(fd, img)) {
+                    img.fds.push_back(fd);
+                    return true;
+                }
+                if (fd >= 0) ::close(fd);
+            }
+
+            int fd = ::open(mip_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            const bool named = fd >= 0;
+            if (!named) {
+                std::FILE* tmp = std::tmpfile();
+                if (!tmp) return false;
+                fd = ::dup(fileno(tmp));
+                std::fclose(tmp);
+                if (fd < 0) return false;
+            }
+            img.fds.push_back(fd);
+            if (!build_pyramid(img)) {
+                // a half written sidecar has no header and is rebuilt next time anyway, this
+                // only gives the space back; remove the file if it can't be emptied.
+                if (named && ::ftruncate(fd, 0) != 0) {
+                    ::unlink(mip_path.c_str());
+                }
+                return false;
+            }
+            return true;
+        }
+
+        bool sidecar_matches(int fd, const image& img) const {
+            uint64_t header[3];
+            return read_at(fd, header, sizeof(header), 0) && header[0] == sidecar_magic
+                && header[1] == uint64_t(img.levels[0].width) && header[2] == uint64_t(img.levels[0].height);
+        }
+
+        // Area weights of source texel k when 'src' texels shrink to 'dst' (src/2 <= dst <= src):
+        // texel k covers [k, k+1) * dst/src of the target axis, so it lands in target 'first'
+        // with weight w0 and in first + 1 with w1. Target texels all cover the same area, so
+        // odd sizes don't give their last texel extra weight, and nothing reaches past the edge.
+        static void box_weights(int k, int src, int dst, int& first, double& w0, double& w1) {
+            const int64_t lo = int64_t(k) * dst, hi = lo + dst;
+            first = static_cast<int>(lo / src);
+            const int64_t split = std::min(hi, int64_t(first + 1) * src);
+            w0 = double(split - lo) / src;
+            w1 = double(hi - split) / src;
+        }
+
+        // Streams the PFM once, bottom row up, cascading area-weighted box filters through all
+        // the levels. Only the one target row still open per level is in memory, plus the row
+        // after it that a straddling source row also reaches into.
+        bool build_pyramid(const image& img) const {
+            const int count = static_cast<int>(img.levels.size());
+            const int fd = img.fds[1];
+            std::vector<std::vector<double>> open_row(count), next_row(count);
+            std::vector<int> rows_in(count, 0), rows_out(count, 0);
+            for (int l = 1; l < count; ++l) {
+                open_row[l].assign(3 * size_t(img.levels[l].width), 0.0);
+                next_row[l].assign(3 * size_t(img.levels[l].width), 0.0);
+            }
+
+            bool ok = true;
+
+            // feeds one row of level 'l' to the next level, recursively.
+            std::function<void(int, const float*)> feed = [&](int l, const float* row) {
+                const int k = rows_in[l]++;
+                if (l + 1 >= count || !ok) return;
+                const level_info& src = img.levels[l];
+                const level_info& dst = img.levels[l + 1];
+
+                std::vector<double> filtered(3 * size_t(dst.width), 0.0);
+                for (int i = 0; i < src.width; ++i) {
+                    int first;
+                    double w0, w1;
+                    box_weights(i, src.width, dst.width, first, w0, w1);
+                    for (int c = 0; c < 3; ++c) {
+                        filtered[3*first + c] += w0 * row[3*i + c];
+                        if (w1 > 0) filtered[3*(first + 1) + c] += w1 * row[3*i + c];
+                    }
+                }
+
+                // rows before 'first' are complete by now, so 'first' is the open row.
+                int first;
+                double w0, w1;
+                box_weights(k, src.height, dst.height, first, w0, w1);
+                for (size_t m = 0; m < filtered.size(); ++m) {
+                    open_row[l + 1][m] += w0 * filtered[m];
+                    next_row[l + 1][m] += w1 * filtered[m];
+                }
+
+                // the open row is complete once the source rows covering it have all arrived.
+                int& j = rows_out[l + 1];
+                if (j < dst.height && int64_t(k + 1) * dst.height >= int64_t(j + 1) * src.height) {
+                    std::vector<float> out(open_row[l + 1].begin(), open_row[l + 1].end());
+                    uint64_t at = dst.offset + 3 * sizeof(float) * uint64_t(j++) * dst.width;
+                    ok = ok && write_at(fd, out.data(), out.size() * sizeof(float), at);
+                    open_row[l + 1].swap(next_row[l + 1]);
+                    std::fill(next_row[l + 1].begin(), next_row[l + 1].end(), 0.0);
+                    feed(l + 1, out.data());
+                }
+            };
+
+            const level_info& base = img.levels[0];
+            std::vector<float> row(3 * size_t(base.width));
+            for (int j = 0; j < base.height && ok; ++j) {
+                uint64_t at = base.offset + 3 * sizeof(float) * uint64_t(j) * base.width;
+                ok = read_at(img.fds[0], row.data(), row.size() * sizeof(float), at);
+                if (!ok) break;
+                if (img.swap) swap_bytes(row.data(), row.size());
+                feed(0, row.data());
+            }
+
+            // the header goes in last, so a sidecar cut short never matches.
+            uint64_t header[sidecar_header / 8] = {sidecar_magic, uint64_t(base.width), uint64_t(base.height)};
+            return ok && write_at(fd, header, sizeof(header), 0);
+        }
+};
+
+#endif
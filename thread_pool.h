@@ -0,0 +1,120 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "numa.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads. run() hands out task indices [0, count) to the
+// workers and blocks until all of them are done, so the same threads can be
+// reused across frames instead of being spawned per render.
+//
+// With numa_pin set, workers are pinned round robin to the NUMA nodes and the task
+// range is cut into one contiguous slice per node. Workers drain their own node's slice
+// first and only then help the others, so the same node keeps rendering (and first
+// touching) the same part of the image from frame to frame.
+class thread_pool {
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable work_cv;
+        std::condition_variable done_cv;
+
+        std::function<void(int)> job;
+        std::vector<int> node_next;    // next task of each node's slice
+        std::vector<int> node_end;     // end of each node's slice
+        int  tasks_left = 0;           // not yet handed out
+        int  task_count = 0;
+        int  tasks_done = 0;
+        bool stop = false;
+        bool pinned = false;
+
+        bool take_task(int node, int& task) {
+            for (size_t k = 0; k < node_next.size(); ++k) {
+                size_t n = (node + k) % node_next.size();
+                if (node_next[n] < node_end[n]) {
+                    task = node_next[n]++;
+                    --tasks_left;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void worker_loop(int node) {
+            if (pinned) {
+                pin_current_thread(numa_topology::system().node_cpus[node]);
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                work_cv.wait(lock, [this] { return stop || tasks_left > 0; });
+                if (stop) return;
+
+                int task;
+                if (!take_task(node, task)) continue;
+                lock.unlock();
+                job(task);
+                lock.lock();
+
+                if (++tasks_done == task_count) {
+                    done_cv.notify_all();
+                }
+            }
+        }
+
+    public:
+        explicit thread_pool(int num_threads, bool numa_pin = false) : pinned(numa_pin) {
+            int nodes = pinned ? numa_topology::system().nodes() : 1;
+            node_next.assign(nodes, 0);
+            node_end.assign(nodes, 0);
+
+            workers.reserve(num_threads);
+            for (int t = 0; t < num_threads; ++t) {
+                workers.emplace_back(&thread_pool::worker_loop, this, t % nodes);
+            }
+        }
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            work_cv.notify_all();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        int size() const { return static_cast<int>(workers.size()); }
+
+        bool numa_pinned() const { return pinned; }
+
+        void run(int count, const std::function<void(int)>& fn) {
+            if (count <= 0) return;
+            std::unique_lock<std::mutex> lock(mutex);
+            job = fn;
+
+            int nodes = static_cast<int>(node_next.size());
+            for (int n = 0; n < nodes; ++n) {
+                node_next[n] = static_cast<int>(static_cast<long long>(count) * n / nodes);
+                node_end[n]  = static_cast<int>(static_cast<long long>(count) * (n + 1) / nodes);
+            }
+            tasks_done = 0;
+            task_count = count;
+            tasks_left = count;
+
+            work_cv.notify_all();
+            done_cv.wait(lock, [this] { return tasks_done == task_count; });
+            task_count = 0;
+        }
+};
+
+#endif
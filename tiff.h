@@ -0,0 +1,158 @@
+#ifndef TIFF_H
+#define TIFF_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Streams an 8-bit RGB image into a tiled, uncompressed TIFF one tile at a time, so the
+// whole image never has to be in memory. Every tile has the same byte size (edge tiles
+// are padded, as TIFF requires), so the header, the tile tables and each tile's place in
+// the file are all known up front: open() writes the header and tables, and
+// write_tile() does a positional write that any thread can call for any tile.
+// Files that would pass 4 GB are written as BigTIFF.
+class tiled_tiff_writer {
+    public:
+        tiled_tiff_writer() {}
+        ~tiled_tiff_writer() { close(); }
+
+        tiled_tiff_writer(const tiled_tiff_writer&) = delete;
+        tiled_tiff_writer& operator=(const tiled_tiff_writer&) = delete;
+
+        // tile_size is rounded up to a multiple of 16, see tile_width().
+        bool open(const std::string& path, int width, int height, int tile_size) {
+            close();
+            image_width = width;
+            image_height = height;
+            tile = (std::max(16, tile_size) + 15) / 16 * 16;
+            tiles_x = (width + tile - 1) / tile;
+            tiles_y = (height + tile - 1) / tile;
+            tile_bytes = uint64_t(tile) * tile * 3;
+
+            const uint64_t count = uint64_t(tiles_x) * tiles_y;
+            big = header_size(false, count) + count * tile_bytes > 0xffffffffull;
+            data_offset = header_size(big, count);
+
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) return false;
+
+            std::vector<uint8_t> header = build_header(count);
+            if (!write_at(header.data(), header.size(), 0)) {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        int tile_width() const { return tile; }
+        int tile_count_x() const { return tiles_x; }
+        int tile_count_y() const { return tiles_y; }
+        bool is_bigtiff() const { return big; }
+
+        // 'rgb' holds tile_width() * tile_width() pixels, 3 bytes each, row major.
+        bool write_tile(int tx, int ty, const uint8_t* rgb) {
+            uint64_t index = uint64_t(ty) * tiles_x + tx;
+            return write_at(rgb, tile_bytes, data_offset + index * tile_bytes);
+        }
+
+        bool close() {
+            if (fd < 0) return true;
+            bool ok = ::close(fd) == 0;
+            fd = -1;
+            return ok;
+        }
+
+    private:
+        int fd = -1;
+        int image_width = 0, image_height = 0;
+        int tile = 0, tiles_x = 0, tiles_y = 0;
+        uint64_t tile_bytes = 0;
+        uint64_t data_offset = 0;
+        bool big = false;
+
+        static const int entry_count = 11;
+
+        static uint64_t header_size(bool bigtiff, uint64_t count) {
+            uint64_t ifd = bigtiff ? 16 + 8 + entry_count * 20 + 8 : 8 + 2 + entry_count * 12 + 4;
+            uint64_t offset_size = bigtiff ? 8 : 4;
+            return ifd + 8 + 2 * count * offset_size;  // + BitsPerSample array, two tile tables
+        }
+
+        bool write_at(const void* data, uint64_t size, uint64_t offset) const {
+            const char* p = static_cast<const char*>(data);
+            while (size > 0) {
+                ssize_t n = ::pwrite(fd, p, size, static_cast<off_t>(offset));
+                if (n <= 0) return false;
+                p += n;
+                size -= n;
+                offset += n;
+            }
+            return true;
+        }
+
+        static void put(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+            for (int b = 0; b < bytes; ++b) {
+                out.push_back(static_cast<uint8_t>(value >> (8 * b)));  // little endian ("II")
+            }
+        }
+
+        std::vector<uint8_t> build_header(uint64_t count) const {
+            enum { SHORT = 3, LONG = 4, LONG8 = 16 };
+            const int off = big ? 8 : 4;            // size of an offset / inline value field
+            const int offset_type = big ? LONG8 : LONG;
+
+            std::vector<uint8_t> out;
+            out.push_back('I');
+            out.push_back('I');
+            if (big) {
+                put(out, 43, 2);
+                put(out, 8, 2);
+                put(out, 0, 2);
+                put(out, 16, 8);
+            } else {
+                put(out, 42, 2);
+                put(out, 8, 4);
+            }
+
+            const uint64_t ifd_end = big ? 16 + 8 + entry_count * 20 + 8 : 8 + 2 + entry_count * 12 + 4;
+            const uint64_t bits_at = ifd_end;
+            const uint64_t offsets_at = bits_at + 8;
+            const uint64_t counts_at = offsets_at + count * off;
+
+            put(out, entry_count, big ? 8 : 2);
+            auto entry = [&](int tag, int type, uint64_t n, uint64_t value) {
+                put(out, tag, 2);
+                put(out, type, 2);
+                put(out, n, off);
+                put(out, value, off);
+            };
+            // a single tile's offset and size fit inline in the entry.
+            entry(256, LONG, 1, image_width);
+            entry(257, LONG, 1, image_height);
+            // BitsPerSample (3 shorts) is inline in BigTIFF's 8 byte field.
+            entry(258, SHORT, 3, big ? 0x000800080008ull : bits_at);
+            entry(259, SHORT, 1, 1);                  // no compression
+            entry(262, SHORT, 1, 2);                  // RGB
+            entry(277, SHORT, 1, 3);
+            entry(284, SHORT, 1, 1);                  // chunky
+            entry(322, LONG, 1, tile);
+            entry(323, LONG, 1, tile);
+            entry(324, offset_type, count, count == 1 ? data_offset : offsets_at);
+            entry(325, offset_type, count, count == 1 ? tile_bytes : counts_at);
+            put(out, 0, off);                         // no next IFD
+
+            put(out, 8, 2);
+            put(out, 8, 2);
+            put(out, 8, 2);
+            put(out, 0, 2);
+            for (uint64_t k = 0; k < count; ++k) put(out, data_offset + k * tile_bytes, off);
+            for (uint64_t k = 0; k < count; ++k) put(out, tile_bytes, off);
+            return out;
+        }
+};
+
+#endif
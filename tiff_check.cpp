@@ -0,0 +1,193 @@
+// Tiled TIFF check: files from tiled_tiff_writer are read back with a small independent
+// parser, which checks the header, the tags and the tile tables against the image that was
+// written, then compares the tile bytes. The BigTIFF case writes a sparse file past 4 GB
+// with only a few tiles filled in, so it needs little disk; the tiles in between read as
+// zeros. A small frame through camera::render_tiled() has to produce a matching file too.
+//
+// Usage: ./tiff_check         prints a line per file, exits 1 on any mismatch
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hittable_list.h"
+#include "camera.h"
+#include "material.h"
+#include "sphere.h"
+#include "tiff.h"
+
+using std::make_shared;
+
+struct tiff_file {
+    int fd = -1;
+    bool big = false;
+    std::map<int, std::vector<uint64_t>> tags;
+
+    ~tiff_file() { if (fd >= 0) ::close(fd); }
+
+    uint64_t read(uint64_t offset, int bytes) const {
+        uint8_t b[8] = {0};
+        if (::pread(fd, b, bytes, static_cast<off_t>(offset)) != bytes) return ~0ull;
+        uint64_t v = 0;
+        for (int k = bytes - 1; k >= 0; --k) v = (v << 8) | b[k];
+        return v;
+    }
+
+    bool open(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0 || read(0, 2) != 0x4949) return false;
+        uint64_t version = read(2, 2);
+        if (version != 42 && version != 43) return false;
+        big = version == 43;
+        if (big && (read(4, 2) != 8 || read(6, 2) != 0)) return false;
+
+        const int off = big ? 8 : 4;
+        const int entry_size = big ? 20 : 12;
+        uint64_t ifd = big ? read(8, 8) : read(4, 4);
+        uint64_t count = read(ifd, big ? 8 : 2);
+        for (uint64_t e = 0; e < count; ++e) {
+            uint64_t at = ifd + (big ? 8 : 2) + e * entry_size;
+            int tag = int(read(at, 2)), type = int(read(at + 2, 2));
+            uint64_t n = read(at + 4, off);
+            int size = type == 3 ? 2 : type == 4 ? 4 : 8;
+            // values that fit in the field are stored inline, others behind an offset.
+            uint64_t base = n * size <= uint64_t(off) ? at + 4 + off : read(at + 4 + off, off);
+            std::vector<uint64_t>& values = tags[tag];
+            for (uint64_t k = 0; k < n; ++k) values.push_back(read(base + k * size, size));
+        }
+        return read(ifd + (big ? 8 : 2) + count * entry_size, off) == 0;
+    }
+
+    uint64_t tag(int id, size_t k = 0) const {
+        auto it = tags.find(id);
+        return it == tags.end() || k >= it->second.size() ? ~0ull : it->second[k];
+    }
+};
+
+// Checks the tags for a width x height RGB image in tile x tile tiles.
+bool check_tags(const tiff_file& f, int width, int height, int tile) {
+    uint64_t tiles = uint64_t((width + tile - 1) / tile) * ((height + tile - 1) / tile);
+    bool ok = f.tag(256) == uint64_t(width) && f.tag(257) == uint64_t(height)
+           && f.tag(258, 0) == 8 && f.tag(258, 1) == 8 && f.tag(258, 2) == 8
+           && f.tag(259) == 1 && f.tag(262) == 2 && f.tag(277) == 3 && f.tag(284) == 1
+           && f.tag(322) == uint64_t(tile) && f.tag(323) == uint64_t(tile)
+           && f.tags.at(324).size() == tiles && f.tags.at(325).size() == tiles;
+    for (uint64_t k = 0; ok && k < tiles; ++k) {
+        ok = f.tag(325, k) == uint64_t(tile) * tile * 3;
+    }
+    return ok;
+}
+
+uint8_t pattern(int tx, int ty, size_t k) {
+    return static_cast<uint8_t>(tx * 31 + ty * 17 + k * 7 + 1);
+}
+
+bool check_tile(const tiff_file& f, int tiles_x, int tile, int tx, int ty, bool written) {
+    size_t bytes = size_t(tile) * tile * 3;
+    std::vector<uint8_t> data(bytes);
+    uint64_t offset = f.tag(324, size_t(ty) * tiles_x + tx);
+    if (::pread(f.fd, data.data(), bytes, static_cast<off_t>(offset)) != ssize_t(bytes)) return false;
+    for (size_t k = 0; k < bytes; ++k) {
+        if (data[k] != (written ? pattern(tx, ty, k) : 0)) return false;
+    }
+    return true;
+}
+
+// Writes the tiles in 'filled' (all of them if empty) and checks the file that comes out.
+bool check_writer(const char* name, const std::string& path, int width, int height, int tile_size,
+                  bool expect_big, std::vector<std::pair<int, int>> filled) {
+    bool ok = true;
+    int tile, tiles_x, tiles_y;
+    {
+        tiled_tiff_writer out;
+        if (!out.open(path, width, height, tile_size)) {
+            std::printf("%-9s can't write %s  FAIL\n", name, path.c_str());
+            return false;
+        }
+        tile = out.tile_width();
+        tiles_x = out.tile_count_x();
+        tiles_y = out.tile_count_y();
+        ok = out.is_bigtiff() == expect_big;
+        if (filled.empty()) {
+            for (int ty = 0; ty < tiles_y; ++ty)
+                for (int tx = 0; tx < tiles_x; ++tx) filled.push_back({tx, ty});
+        }
+        std::vector<uint8_t> bytes(size_t(tile) * tile * 3);
+        for (const auto& t : filled) {
+            for (size_t k = 0; k < bytes.size(); ++k) bytes[k] = pattern(t.first, t.second, k);
+            ok = out.write_tile(t.first, t.second, bytes.data()) && ok;
+        }
+        ok = out.close() && ok;
+    }
+
+    tiff_file f;
+    ok = f.open(path) && f.big == expect_big && check_tags(f, width, height, tile) && ok;
+    int tiles_checked = 0;
+    for (const auto& t : filled) {
+        ok = ok && check_tile(f, tiles_x, tile, t.first, t.second, true);
+        ++tiles_checked;
+    }
+    if (ok && expect_big) {
+        // a tile nobody wrote, between the filled ones.
+        ok = check_tile(f, tiles_x, tile, 1, 0, false);
+    }
+    std::printf("%-9s %dx%d in %d px tiles  %s  %d tiles compared%s\n", name, width, height, tile,
+                f.big ? "BigTIFF" : "TIFF", tiles_checked, ok ? "" : "  FAIL");
+    std::remove(path.c_str());
+    return ok;
+}
+
+bool check_render() {
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, 0, -1), 0.5, make_shared<lambertian>(color(0.7, 0.3, 0.3))));
+    world.add(make_shared<sphere>(point3(0, -100.5, -1), 100, make_shared<lambertian>(color(0.8, 0.8, 0))));
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 70;
+    cam.samples_per_pixel = 2;
+    cam.max_depth = 4;
+    cam.show_progress = false;
+
+    const std::string path = "/tmp/tiff_check_render.tif";
+    bool ok = cam.render_tiled(world, light_list(), path, 16);
+    const int width = cam.image_width, height = cam.output_height(), tile = 16;
+
+    tiff_file f;
+    ok = ok && f.open(path) && !f.big && check_tags(f, width, height, tile);
+    // padding past the right and bottom edges stays black, the image itself isn't.
+    int tiles_x = (width + tile - 1) / tile, tiles_y = (height + tile - 1) / tile;
+    int lit = 0, bad_padding = 0;
+    for (int ty = 0; ok && ty < tiles_y; ++ty) {
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            std::vector<uint8_t> data(size_t(tile) * tile * 3);
+            ::pread(f.fd, data.data(), data.size(), static_cast<off_t>(f.tag(324, size_t(ty) * tiles_x + tx)));
+            for (int y = 0; y < tile; ++y) {
+                for (int x = 0; x < tile; ++x) {
+                    const uint8_t* px = &data[3 * (y * tile + x)];
+                    bool inside = tx * tile + x < width && ty * tile + y < height;
+                    bool black = px[0] == 0 && px[1] == 0 && px[2] == 0;
+                    lit += inside && !black;
+                    bad_padding += !inside && !black;
+                }
+            }
+        }
+    }
+    ok = ok && bad_padding == 0 && lit > width * height / 2;
+    std::printf("%-9s %dx%d in %d px tiles  %d lit pixels, %d bad padding%s\n", "render", width, height, tile,
+                lit, bad_padding, ok ? "" : "  FAIL");
+    std::remove(path.c_str());
+    return ok;
+}
+
+int main() {
+    int failures = 0;
+    failures += !check_writer("small", "/tmp/tiff_check_small.tif", 100, 37, 10, false, {});
+    failures += !check_writer("one-tile", "/tmp/tiff_check_one.tif", 20, 9, 32, false, {});
+    // 40000 x 36000 RGB is 4.3 GB of tiles.
+    failures += !check_writer("bigtiff", "/tmp/tiff_check_big.tif", 40000, 36000, 512, true,
+                              {{0, 0}, {2, 0}, {40, 35}, {78, 70}});
+    failures += !check_render();
+    return failures == 0 ? 0 : 1;
+}
@@ -154,26 +154,72 @@ vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
-vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() < 1) {
-            return p;
-        }
-    }
+// Closed-form warps from uniform numbers in [0,1), no rejection loops and no branches
+// (the selects compile to blends), so each one costs the same on every call.
+// The concentric map only needs sin/cos on [-pi/4, pi/4], where short polynomials are
+// exact to double precision.
+
+inline double sin_quarter(double x) {
+    // sin(x) for |x| <= pi/4, Taylor to x^15.
+    auto x2 = x * x;
+    return x * (1 + x2 * (-1.0/6 + x2 * (1.0/120 + x2 * (-1.0/5040 + x2 * (1.0/362880
+             + x2 * (-1.0/39916800 + x2 * (1.0/6227020800 - x2 * (1.0/1307674368000))))))));
 }
 
-vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() < 1) {
-            return p;
-        }
-    }
+inline double cos_quarter(double x) {
+    // cos(x) for |x| <= pi/4, Taylor to x^16.
+    auto x2 = x * x;
+    return 1 + x2 * (-0.5 + x2 * (1.0/24 + x2 * (-1.0/720 + x2 * (1.0/40320 + x2 * (-1.0/3628800
+             + x2 * (1.0/479001600 + x2 * (-1.0/87178291200 + x2 * (1.0/20922789888000))))))));
+}
+
+// Shirley-Chiu concentric square to disk map, area preserving.
+inline void concentric_disk(double u1, double u2, double& x, double& y) {
+    auto a = 2 * u1 - 1;
+    auto b = 2 * u2 - 1;
+    bool swap = fabs(a) < fabs(b);
+    auto r   = swap ? b : a;
+    auto num = swap ? a : b;
+    auto theta = (M_PI / 4) * (num / (r == 0 ? 1 : r));
+    auto s = sin_quarter(theta);
+    auto c = cos_quarter(theta);
+    x = r * (swap ? s : c);
+    y = r * (swap ? c : s);
+}
+
+inline vec3 sample_uniform_disk(double u1, double u2) {
+    double x, y;
+    concentric_disk(u1, u2, x, y);
+    return vec3(x, y, 0);
+}
+
+inline vec3 sample_uniform_sphere(double u1, double u2) {
+    // lifts the disk to the sphere keeping area: z = 1 - 2 r^2.
+    double x, y;
+    concentric_disk(u1, u2, x, y);
+    auto r2 = x * x + y * y;
+    auto scale = 2 * sqrt(fmax(0.0, 1 - r2));
+    return vec3(x * scale, y * scale, 1 - 2 * r2);
+}
+
+inline vec3 sample_cosine_hemisphere(double u1, double u2) {
+    // Malley: project the disk up onto the +z hemisphere, pdf = z / pi.
+    double x, y;
+    concentric_disk(u1, u2, x, y);
+    return vec3(x, y, sqrt(fmax(0.0, 1 - x * x - y * y)));
+}
+
+vec3 random_in_unit_disk() {
+    return sample_uniform_disk(random_double(), random_double());
 }
 
 vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+    return sample_uniform_sphere(random_double(), random_double());
+}
+
+vec3 random_in_unit_sphere() {
+    // uniform radius in volume is the cube root.
+    return std::cbrt(random_double()) * random_unit_vector();
 }
 
 vec3 sample_square() {